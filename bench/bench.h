@@ -0,0 +1,58 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+// Keeps the compiler from optimizing `value` (and the computation producing it) away
+template <typename T>
+inline void DoNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// Runs `f` `iterations` times and returns the mean time per call in nanoseconds
+template <typename F>
+double NsPerOp(size_t iterations, F&& f) {
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        f(i);
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / static_cast<double>(iterations);
+}
+
+// Best of `repetitions` runs of NsPerOp, which filters out warm-up and scheduler noise
+template <typename F>
+double BestNsPerOp(size_t repetitions, size_t iterations, F&& f) {
+    double best = NsPerOp(iterations, f);
+    for (size_t i = 1; i < repetitions; ++i) {
+        double current = NsPerOp(iterations, f);
+        if (current < best) {
+            best = current;
+        }
+    }
+    return best;
+}
+
+// Mean time per call in nanoseconds of `samples` timed batches of `batch` calls each.
+// `prepare` and `cleanup` run around every batch, outside of the timed part.
+template <typename Prepare, typename F, typename Cleanup>
+std::vector<double> SampleNsPerOp(size_t samples, size_t batch, Prepare&& prepare, F&& f,
+                                  Cleanup&& cleanup) {
+    std::vector<double> result;
+    result.reserve(samples);
+    for (size_t s = 0; s < samples; ++s) {
+        prepare();
+        result.push_back(NsPerOp(batch, f));
+        cleanup();
+    }
+    return result;
+}
+
+// Nearest-rank percentile, `p` in [0, 100]
+inline double Percentile(std::vector<double> samples, double p) {
+    std::sort(samples.begin(), samples.end());
+    size_t rank = static_cast<size_t>(p / 100 * static_cast<double>(samples.size() - 1) + 0.5);
+    return samples[rank];
+}
@@ -0,0 +1,106 @@
+#include <weak/atomic_shared.h>
+
+#include "bench.h"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Reader scaling of a published configuration: 1..64 reader threads copy the current
+// pointer and read from it while one writer keeps publishing new versions.
+// AtomicSharedPtr is compared against a SharedPtr guarded by a mutex.
+
+namespace {
+
+constexpr auto kDuration = std::chrono::milliseconds(200);
+constexpr auto kWritePeriod = std::chrono::microseconds(50);
+
+struct Config {
+    explicit Config(int version) : version(version) {
+    }
+
+    int version;
+    int routes[15] = {};
+};
+
+class MutexPublisher {
+public:
+    SharedPtr<Config> Load() {
+        std::lock_guard guard(mutex_);
+        return current_;
+    }
+
+    void Store(SharedPtr<Config> next) {
+        std::lock_guard guard(mutex_);
+        current_.Swap(next);
+    }
+
+private:
+    std::mutex mutex_;
+    SharedPtr<Config> current_ = MakeShared<Config>(0);
+};
+
+class AtomicPublisher {
+public:
+    SharedPtr<Config> Load() {
+        return current_.Load();
+    }
+
+    void Store(SharedPtr<Config> next) {
+        current_.Store(std::move(next));
+    }
+
+private:
+    AtomicSharedPtr<Config> current_{MakeShared<Config>(0)};
+};
+
+// Returns the total number of reads per second across all readers
+template <typename Publisher>
+double ReadsPerSecond(size_t num_readers) {
+    Publisher publisher;
+    std::atomic<bool> stop = false;
+    std::atomic<uint64_t> total_reads = 0;
+
+    std::vector<std::thread> readers;
+    for (size_t i = 0; i < num_readers; ++i) {
+        readers.emplace_back([&] {
+            uint64_t reads = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                auto config = publisher.Load();
+                DoNotOptimize(config->version);
+                ++reads;
+            }
+            total_reads += reads;
+        });
+    }
+    std::thread writer([&] {
+        for (int version = 1; !stop.load(std::memory_order_relaxed); ++version) {
+            publisher.Store(MakeShared<Config>(version));
+            std::this_thread::sleep_for(kWritePeriod);
+        }
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(kDuration);
+    stop = true;
+    for (auto& reader : readers) {
+        reader.join();
+    }
+    writer.join();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return static_cast<double>(total_reads.load()) / elapsed.count();
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "readers\tAtomicSharedPtr Mreads/s\tmutex Mreads/s\n";
+    for (size_t readers = 1; readers <= 64; readers *= 2) {
+        std::cout << readers << "\t" << ReadsPerSecond<AtomicPublisher>(readers) / 1e6 << "\t"
+                  << ReadsPerSecond<MutexPublisher>(readers) / 1e6 << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,168 @@
+#include <intrusive/intrusive.h>
+#include <weak/shared.h>
+#include <weak/weak.h>
+
+#include "bench.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// How reference counting scales with cores. 1..N threads, each pinned to its own CPU, copy and
+// destroy pointers in a loop; the table shows the total throughput in Mops/s per thread count,
+// and the speedup over one thread in parentheses. Ideal scaling doubles the throughput with
+// the threads; a single block shared by all of them ping-pongs its cache line instead.
+// N is the first argument, the number of CPUs by default.
+
+namespace {
+
+constexpr size_t kIterations = 1 << 21;
+constexpr size_t kFanOut = 16;
+
+struct Payload {
+    int value = 0;
+};
+
+// Blocks of different threads must not share a cache line either
+struct alignas(64) PaddedPayload {
+    int value = 0;
+};
+
+class AtomicCounter {
+public:
+    size_t IncRef() {
+        return count_.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    size_t DecRef() {
+        return count_.fetch_sub(1, std::memory_order_acq_rel) - 1;
+    }
+    size_t RefCount() const {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<size_t> count_ = 0;
+};
+
+struct IntrusivePayload : RefCounted<IntrusivePayload, AtomicCounter, DefaultDelete> {
+    int value = 0;
+};
+
+void PinTo(size_t cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % std::thread::hardware_concurrency(), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Runs `work(thread)` kIterations times on each of `threads` pinned threads at once and
+// returns the total throughput in Mops/s
+double Throughput(size_t threads, const std::function<void(size_t)>& work) {
+    std::atomic<size_t> ready = 0;
+    std::atomic<bool> start = false;
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            PinTo(t);
+            ++ready;
+            while (!start.load()) {
+            }
+            for (size_t i = 0; i < kIterations; ++i) {
+                work(t);
+            }
+        });
+    }
+    while (ready.load() != threads) {
+    }
+    auto begin = std::chrono::steady_clock::now();
+    start = true;
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - begin;
+    return static_cast<double>(threads * kIterations) / elapsed.count();
+}
+
+struct Workload {
+    std::string name;
+    std::function<void(size_t)> work;
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t max_threads = argc > 1 ? std::stoul(argv[1]) : std::thread::hardware_concurrency();
+
+    auto shared = MakeShared<Payload>();
+    WeakPtr<Payload> weak = shared;
+    std::vector<SharedPtr<PaddedPayload>> per_thread;
+    std::vector<WeakPtr<PaddedPayload>> weak_per_thread;
+    for (size_t t = 0; t < max_threads; ++t) {
+        per_thread.push_back(MakeShared<PaddedPayload>());
+        weak_per_thread.emplace_back(per_thread.back());
+    }
+    auto intrusive = MakeIntrusive<IntrusivePayload>();
+    std::vector<std::array<SharedPtr<Payload>, kFanOut>> fan_out(max_threads);
+
+    std::vector<Workload> workloads = {
+        {"SharedPtr copy, one block",
+         [&](size_t) {
+             SharedPtr<Payload> copy(shared);
+             DoNotOptimize(copy);
+         }},
+        {"SharedPtr copy, block per thread",
+         [&](size_t t) {
+             SharedPtr<PaddedPayload> copy(per_thread[t]);
+             DoNotOptimize(copy);
+         }},
+        {"WeakPtr::Lock, one block", [&](size_t) { DoNotOptimize(weak.Lock()); }},
+        {"WeakPtr::Lock, block per thread",
+         [&](size_t t) { DoNotOptimize(weak_per_thread[t].Lock()); }},
+        // Per-op cost of a broadcast to kFanOut subscribers: one counter update each way
+        {"SharedPtr ShareN/ReleaseN, one block",
+         [&](size_t t) {
+             auto& batch = fan_out[t];
+             shared.ShareN(kFanOut, batch.begin());
+             ReleaseN(batch.begin(), batch.end());
+             DoNotOptimize(batch);
+         }},
+        {"IntrusivePtr copy (atomic), one object",
+         [&](size_t) {
+             IntrusivePtr<IntrusivePayload> copy(intrusive);
+             DoNotOptimize(copy);
+         }},
+    };
+
+    // mops[w][threads - 1]
+    std::vector<std::vector<double>> mops(workloads.size());
+    for (size_t w = 0; w < workloads.size(); ++w) {
+        for (size_t threads = 1; threads <= max_threads; ++threads) {
+            mops[w].push_back(Throughput(threads, workloads[w].work));
+        }
+    }
+
+    std::cout << "Mops/s (speedup over 1 thread)\nthreads";
+    for (const auto& workload : workloads) {
+        std::cout << "\t" << workload.name;
+    }
+    std::cout << "\n" << std::fixed << std::setprecision(1);
+    for (size_t threads = 1; threads <= max_threads; ++threads) {
+        std::cout << threads;
+        for (const auto& curve : mops) {
+            std::cout << "\t" << curve[threads - 1] << " (" << std::setprecision(2)
+                      << curve[threads - 1] / curve[0] << ")" << std::setprecision(1);
+        }
+        std::cout << "\n";
+    }
+    return 0;
+}
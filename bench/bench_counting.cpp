@@ -0,0 +1,69 @@
+#include <weak/shared.h>
+
+#include "bench.h"
+
+#include <atomic>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// Copy/destroy cost under the counting mode this binary was built with:
+// bench_counting uses atomic counters, bench_counting_biased biased ones.
+
+namespace {
+
+#ifdef SHARED_PTR_BIASED_COUNTING
+constexpr const char* kMode = "biased";
+#else
+constexpr const char* kMode = "atomic";
+#endif
+
+constexpr size_t kIterations = 1 << 23;
+constexpr size_t kRepetitions = 5;
+
+// Every thread copies and destroys one pointer; the owner does `kIterations` rounds
+// and each of the others does `kIterations / other_share` rounds.
+double MixedOwnerNsPerOp(size_t other_threads, size_t other_share) {
+    auto owned = MakeShared<int>(42);
+    std::atomic<bool> start = false;
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < other_threads; ++i) {
+        threads.emplace_back([&, escaped = owned] {
+            while (!start.load()) {
+            }
+            for (size_t j = 0; j < kIterations / other_share; ++j) {
+                SharedPtr<int> copy(escaped);
+                DoNotOptimize(copy);
+            }
+        });
+    }
+    start = true;
+    double owner_ns = NsPerOp(kIterations, [&](size_t) {
+        SharedPtr<int> copy(owned);
+        DoNotOptimize(copy);
+    });
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    return owner_ns;
+}
+
+}  // namespace
+
+int main() {
+    auto owned = MakeShared<int>(42);
+    double single_ns = BestNsPerOp(kRepetitions, kIterations, [&](size_t) {
+        SharedPtr<int> copy(owned);
+        DoNotOptimize(copy);
+    });
+
+    std::cout << "mode\tworkload\towner copy+destroy ns/op\n";
+    std::cout << kMode << "\tsingle thread\t" << single_ns << "\n";
+    for (size_t other_threads : {1, 3}) {
+        for (size_t other_share : {100, 10, 1}) {
+            std::cout << kMode << "\towner + " << other_threads << " threads at 1/" << other_share
+                      << " rate\t" << MixedOwnerNsPerOp(other_threads, other_share) << "\n";
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,56 @@
+#include <weak/shared.h>
+
+#include "bench.h"
+
+#include <iostream>
+#include <vector>
+
+// Dereferencing a SharedPtr should cost exactly as much as dereferencing a raw pointer,
+// whether the object came from `new` or from MakeShared.
+
+namespace {
+
+constexpr size_t kPointers = 1 << 10;
+constexpr size_t kIterations = 1 << 24;
+constexpr size_t kRepetitions = 7;
+
+struct Payload {
+    int value;
+};
+
+}  // namespace
+
+int main() {
+    std::vector<Payload*> raw;
+    std::vector<SharedPtr<Payload>> from_new;
+    std::vector<SharedPtr<Payload>> from_make_shared;
+    for (size_t i = 0; i < kPointers; ++i) {
+        raw.push_back(new Payload{static_cast<int>(i)});
+        from_new.emplace_back(new Payload{static_cast<int>(i)});
+        from_make_shared.push_back(MakeShared<Payload>(Payload{static_cast<int>(i)}));
+    }
+
+    double raw_ns = BestNsPerOp(kRepetitions, kIterations, [&](size_t i) {
+        DoNotOptimize(raw[i % kPointers]->value);
+    });
+    double new_ns = BestNsPerOp(kRepetitions, kIterations, [&](size_t i) {
+        DoNotOptimize(from_new[i % kPointers]->value);
+    });
+    double make_shared_ns = BestNsPerOp(kRepetitions, kIterations, [&](size_t i) {
+        DoNotOptimize((*from_make_shared[i % kPointers]).value);
+    });
+    double get_ns = BestNsPerOp(kRepetitions, kIterations, [&](size_t i) {
+        DoNotOptimize(from_make_shared[i % kPointers].Get()->value);
+    });
+
+    std::cout << "dereference\tns/op\tvs raw\n";
+    std::cout << "raw pointer\t" << raw_ns << "\t1\n";
+    std::cout << "SharedPtr(new T)->\t" << new_ns << "\t" << new_ns / raw_ns << "\n";
+    std::cout << "*MakeShared<T>()\t" << make_shared_ns << "\t" << make_shared_ns / raw_ns << "\n";
+    std::cout << "MakeShared<T>().Get()\t" << get_ns << "\t" << get_ns / raw_ns << "\n";
+
+    for (Payload* p : raw) {
+        delete p;
+    }
+    return 0;
+}
@@ -0,0 +1,130 @@
+#include <intrusive/intrusive.h>
+#include <unique/unique.h>
+#include <weak/shared.h>
+#include <weak/weak.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Memory cost of keeping many small objects alive through each ownership style.
+// Every path runs in a forked child, so that memory freed by an earlier path cannot be reused
+// by a later one. A path creates the objects, keeping the handles in a vector, and reports:
+//   bytes/object: growth of the resident set per object, handles and allocator overhead included
+//   peak RSS:     high-water mark of the child, which also covers vector growth
+//   teardown:     time to destroy every handle and object
+// The object count is the first argument, 10M by default.
+
+namespace {
+
+struct Node {
+    uint64_t key = 0;
+    uint64_t value = 0;
+};
+
+struct IntrusiveNode : SimpleRefCounted<IntrusiveNode> {
+    uint64_t key = 0;
+    uint64_t value = 0;
+};
+
+// Field of /proc/self/status in KiB, e.g. VmRSS or VmHWM
+size_t StatusKiB(const std::string& field) {
+    std::ifstream status("/proc/self/status");
+    std::string name;
+    while (status >> name) {
+        if (name == field + ":") {
+            size_t kib = 0;
+            status >> kib;
+            return kib;
+        }
+        status.ignore(SIZE_MAX, '\n');
+    }
+    return 0;
+}
+
+// Creates `count` handles with `make(i)`, then destroys them
+template <typename Handle, typename Make>
+void Measure(const char* name, size_t count, Make make) {
+    size_t before = StatusKiB("VmRSS");
+    std::vector<Handle> handles;
+    handles.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        handles.push_back(make(i));
+    }
+    size_t after = StatusKiB("VmRSS");
+
+    auto start = std::chrono::steady_clock::now();
+    handles = std::vector<Handle>();
+    std::chrono::duration<double, std::milli> teardown = std::chrono::steady_clock::now() - start;
+
+    std::cout << name << "\t" << sizeof(Handle) << "\t"
+              << static_cast<double>(after - before) * 1024 / static_cast<double>(count) << "\t"
+              << StatusKiB("VmHWM") / 1024 << "\t" << teardown.count() << std::endl;
+}
+
+// Objects observed by WeakPtr-s: a strong and a weak handle per object
+template <typename Make>
+void MeasureObserved(const char* name, size_t count, Make make) {
+    struct Observed {
+        SharedPtr<Node> owner;
+        WeakPtr<Node> observer;
+    };
+    Measure<Observed>(name, count, [&](size_t i) {
+        SharedPtr<Node> owner = make(i);
+        WeakPtr<Node> observer(owner);
+        return Observed{std::move(owner), std::move(observer)};
+    });
+}
+
+// Objects that expired while WeakPtr-s still observe them: only the weak handles are kept
+template <typename Make>
+void MeasureExpired(const char* name, size_t count, Make make) {
+    Measure<WeakPtr<Node>>(name, count, [&](size_t i) { return WeakPtr<Node>(make(i)); });
+}
+
+template <typename F>
+void InChild(F f) {
+    // Otherwise the child inherits and prints again whatever is still buffered
+    std::cout.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        f();
+        std::exit(0);
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? std::stoul(argv[1]) : 10'000'000;
+    auto make_shared = [](size_t i) { return MakeShared<Node>(Node{i, i}); };
+    auto shared_from_new = [](size_t i) { return SharedPtr<Node>(new Node{i, i}); };
+
+    std::cout << count << " objects of " << sizeof(Node) << " bytes\n";
+    std::cout << "path\thandle bytes\tbytes/object\tpeak RSS MiB\tteardown ms\n";
+    InChild([&] {
+        Measure<UniquePtr<Node>>("UniquePtr", count,
+                                 [](size_t i) { return UniquePtr<Node>(new Node{i, i}); });
+    });
+    InChild([&] { Measure<SharedPtr<Node>>("SharedPtr(new T)", count, shared_from_new); });
+    InChild([&] { Measure<SharedPtr<Node>>("MakeShared", count, make_shared); });
+    InChild([&] {
+        Measure<IntrusivePtr<IntrusiveNode>>("MakeIntrusive", count, [](size_t) {
+            return MakeIntrusive<IntrusiveNode>();
+        });
+    });
+    InChild([&] { MeasureObserved("SharedPtr(new T) + WeakPtr", count, shared_from_new); });
+    InChild([&] { MeasureObserved("MakeShared + WeakPtr", count, make_shared); });
+    InChild([&] { MeasureExpired("SharedPtr(new T), only WeakPtr left", count, shared_from_new); });
+    InChild([&] { MeasureExpired("MakeShared, only WeakPtr left", count, make_shared); });
+    return 0;
+}
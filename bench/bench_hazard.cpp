@@ -0,0 +1,108 @@
+#include <weak/shared.h>
+#include <weak/weak.h>
+
+#include "bench.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Read throughput of one shared object through a SharedPtr copy, WeakPtr::Lock and a
+// HazardGuard. 1..N threads, each pinned to its own CPU, read two fields of the object in a
+// loop; the table shows the total Mops/s per thread count. The copy and the Lock write the
+// block's cache line twice per read, the guard only writes its own thread's hazard slot.
+// N is the first argument, the number of CPUs by default.
+// Built with SHARED_PTR_HAZARD_POINTERS.
+
+namespace {
+
+constexpr size_t kIterations = 1 << 21;
+
+struct Config {
+    int version = 1;
+    int limit = 100;
+};
+
+void PinTo(size_t cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % std::thread::hardware_concurrency(), &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+// Runs `read()` kIterations times on each of `threads` pinned threads at once and returns the
+// total throughput in Mops/s
+double Throughput(size_t threads, const std::function<void()>& read) {
+    std::atomic<size_t> ready = 0;
+    std::atomic<bool> start = false;
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            PinTo(t);
+            ++ready;
+            while (!start.load()) {
+            }
+            for (size_t i = 0; i < kIterations; ++i) {
+                read();
+            }
+        });
+    }
+    while (ready.load() != threads) {
+    }
+    auto begin = std::chrono::steady_clock::now();
+    start = true;
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - begin;
+    return static_cast<double>(threads * kIterations) / elapsed.count();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t max_threads = argc > 1 ? std::stoul(argv[1]) : std::thread::hardware_concurrency();
+
+    auto config = MakeShared<Config>();
+    WeakPtr<Config> weak = config;
+
+    std::vector<std::pair<std::string, std::function<void()>>> readers = {
+        {"SharedPtr copy",
+         [&] {
+             SharedPtr<Config> copy(config);
+             DoNotOptimize(copy->version + copy->limit);
+         }},
+        {"WeakPtr::Lock",
+         [&] {
+             SharedPtr<Config> locked = weak.Lock();
+             DoNotOptimize(locked->version + locked->limit);
+         }},
+        {"HazardGuard",
+         [&] {
+             HazardGuard guard(weak);
+             DoNotOptimize(guard->version + guard->limit);
+         }},
+    };
+
+    std::cout << "Mops/s\nthreads";
+    for (const auto& reader : readers) {
+        std::cout << "\t" << reader.first;
+    }
+    std::cout << "\n" << std::fixed << std::setprecision(1);
+    for (size_t threads = 1; threads <= max_threads; ++threads) {
+        std::cout << threads;
+        for (const auto& reader : readers) {
+            std::cout << "\t" << Throughput(threads, reader.second);
+        }
+        std::cout << "\n";
+    }
+    return 0;
+}
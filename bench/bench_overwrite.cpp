@@ -0,0 +1,65 @@
+#include <unique/unique.h>
+#include <weak/shared.h>
+
+#include "bench.h"
+
+#include <array>
+#include <iostream>
+
+// MakeShared value-initializes its object, so a 64 KiB buffer is zeroed before the caller
+// overwrites it. The ForOverwrite factories default-initialize and skip that memset; the
+// difference should be the cost of clearing 64 KiB.
+
+namespace {
+
+constexpr size_t kBufferSize = 1 << 16;
+constexpr size_t kIterations = 1 << 14;
+constexpr size_t kRepetitions = 7;
+
+using Buffer = std::array<char, kBufferSize>;
+
+// Writes one byte only, the way a short read would
+template <typename Ptr>
+void Touch(const Ptr& ptr, size_t i) {
+    ptr.Get()[0] = static_cast<char>(i);
+    DoNotOptimize(ptr.Get());
+}
+
+}  // namespace
+
+int main() {
+    double make_shared_ns = BestNsPerOp(kRepetitions, kIterations, [](size_t i) {
+        auto ptr = MakeShared<Buffer>();
+        (*ptr)[0] = static_cast<char>(i);
+        DoNotOptimize(ptr.Get());
+    });
+    double overwrite_ns = BestNsPerOp(kRepetitions, kIterations, [](size_t i) {
+        auto ptr = MakeSharedForOverwrite<Buffer>();
+        (*ptr)[0] = static_cast<char>(i);
+        DoNotOptimize(ptr.Get());
+    });
+    double array_ns = BestNsPerOp(kRepetitions, kIterations, [](size_t i) {
+        Touch(MakeShared<char[]>(kBufferSize), i);
+    });
+    double array_overwrite_ns = BestNsPerOp(kRepetitions, kIterations, [](size_t i) {
+        Touch(MakeSharedForOverwrite<char[]>(kBufferSize), i);
+    });
+    double unique_ns = BestNsPerOp(kRepetitions, kIterations, [](size_t i) {
+        Touch(UniquePtr<char[]>(new char[kBufferSize]()), i);
+    });
+    double unique_overwrite_ns = BestNsPerOp(kRepetitions, kIterations, [](size_t i) {
+        Touch(MakeUniqueForOverwrite<char[]>(kBufferSize), i);
+    });
+
+    std::cout << "64 KiB buffer\tns/op\tvs value-initialized\n";
+    std::cout << "MakeShared<array>\t" << make_shared_ns << "\t1\n";
+    std::cout << "MakeSharedForOverwrite<array>\t" << overwrite_ns << "\t"
+              << overwrite_ns / make_shared_ns << "\n";
+    std::cout << "MakeShared<char[]>\t" << array_ns << "\t1\n";
+    std::cout << "MakeSharedForOverwrite<char[]>\t" << array_overwrite_ns << "\t"
+              << array_overwrite_ns / array_ns << "\n";
+    std::cout << "UniquePtr(new char[n]())\t" << unique_ns << "\t1\n";
+    std::cout << "MakeUniqueForOverwrite<char[]>\t" << unique_overwrite_ns << "\t"
+              << unique_overwrite_ns / unique_ns << "\n";
+    return 0;
+}
@@ -0,0 +1,276 @@
+#include <intrusive/intrusive.h>
+#include <unique/unique.h>
+#include <weak/shared.h>
+#include <weak/weak.h>
+
+#include "bench.h"
+
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Every basic operation of every pointer next to its std counterpart, as ns/op percentiles over
+// timed batches. Prints a table and writes the same numbers as JSON to the file named by the
+// first argument (bench_pointers.json by default), to be compared between releases.
+// IntrusivePtr and LocalSharedPtr have no std counterpart; WeakPtr is compared to std::weak_ptr.
+// libstdc++ counts std::shared_ptr references without atomics until the process starts its
+// first thread, so one is started up front to compare like with like.
+
+namespace {
+
+constexpr size_t kBatch = 1 << 10;
+constexpr size_t kSamples = 1000;
+
+struct Payload {
+    int value = 0;
+};
+
+struct IntrusivePayload : SimpleRefCounted<IntrusivePayload> {
+    int value = 0;
+};
+
+// Storage for kBatch pointers that are constructed and destroyed by hand, so that a batch can
+// time construction or destruction alone
+template <typename Ptr>
+class Slots {
+public:
+    Slots() : storage_(new Storage[kBatch]) {
+    }
+
+    Slots(const Slots&) = delete;
+    Slots& operator=(const Slots&) = delete;
+
+    template <typename... Args>
+    void Emplace(size_t i, Args&&... args) {
+        ::new (&storage_[i]) Ptr(std::forward<Args>(args)...);
+    }
+
+    void Destroy(size_t i) {
+        (*this)[i].~Ptr();
+    }
+
+    void DestroyAll() {
+        for (size_t i = 0; i < kBatch; ++i) {
+            Destroy(i);
+        }
+    }
+
+    Ptr& operator[](size_t i) {
+        return *std::launder(reinterpret_cast<Ptr*>(&storage_[i]));
+    }
+
+private:
+    struct Storage {
+        alignas(Ptr) unsigned char bytes[sizeof(Ptr)];
+    };
+
+    std::unique_ptr<Storage[]> storage_;
+};
+
+struct Result {
+    std::string pointer;
+    std::string operation;
+    std::vector<double> samples;
+};
+
+std::vector<Result> results;
+
+void Record(const std::string& pointer, const std::string& operation,
+            std::vector<double> samples) {
+    results.push_back({pointer, operation, std::move(samples)});
+}
+
+// `make(i)` returns a fresh Ptr
+template <typename Ptr, typename Make>
+void TimeConstruct(const std::string& pointer, const std::string& operation, Make make) {
+    Slots<Ptr> slots;
+    Record(pointer, operation,
+           SampleNsPerOp(
+               kSamples, kBatch, [] {}, [&](size_t i) { slots.Emplace(i, make(i)); },
+               [&] { slots.DestroyAll(); }));
+}
+
+template <typename Ptr, typename Make>
+void TimeDestroy(const std::string& pointer, Make make) {
+    Slots<Ptr> slots;
+    Record(pointer, "destroy",
+           SampleNsPerOp(
+               kSamples, kBatch,
+               [&] {
+                   for (size_t i = 0; i < kBatch; ++i) {
+                       slots.Emplace(i, make(i));
+                   }
+               },
+               [&](size_t i) { slots.Destroy(i); }, [] {}));
+}
+
+// Copies (or moves) every pointer of a batch into a second set of slots
+template <typename Ptr, typename Make, typename Transfer>
+void TimeTransfer(const std::string& pointer, const std::string& operation, Make make,
+                  Transfer transfer) {
+    Slots<Ptr> from;
+    Slots<Ptr> to;
+    Record(pointer, operation,
+           SampleNsPerOp(
+               kSamples, kBatch,
+               [&] {
+                   for (size_t i = 0; i < kBatch; ++i) {
+                       from.Emplace(i, make(i));
+                   }
+               },
+               [&](size_t i) { to.Emplace(i, transfer(from[i])); },
+               [&] {
+                   to.DestroyAll();
+                   from.DestroyAll();
+               }));
+}
+
+template <typename Ptr, typename Make>
+void TimeCopy(const std::string& pointer, Make make) {
+    TimeTransfer<Ptr>(pointer, "copy", make, [](const Ptr& ptr) -> const Ptr& { return ptr; });
+}
+
+template <typename Ptr, typename Make>
+void TimeMove(const std::string& pointer, Make make) {
+    TimeTransfer<Ptr>(pointer, "move", make, [](Ptr& ptr) -> Ptr&& { return std::move(ptr); });
+}
+
+// `use(ptr)` is timed on every pointer of a batch that stays alive across samples
+template <typename Ptr, typename Make, typename Use>
+void TimeUse(const std::string& pointer, const std::string& operation, Make make, Use use) {
+    Slots<Ptr> slots;
+    for (size_t i = 0; i < kBatch; ++i) {
+        slots.Emplace(i, make(i));
+    }
+    Record(pointer, operation,
+           SampleNsPerOp(
+               kSamples, kBatch, [] {}, [&](size_t i) { use(slots[i]); }, [] {}));
+    slots.DestroyAll();
+}
+
+template <typename Ptr>
+void TimeDereference(const std::string& pointer, auto make) {
+    TimeUse<Ptr>(pointer, "dereference", make, [](const Ptr& ptr) { DoNotOptimize(ptr->value); });
+}
+
+std::string Json() {
+    std::string json = "{\n  \"unit\": \"ns/op\",\n  \"batch\": " + std::to_string(kBatch) +
+                       ",\n  \"samples\": " + std::to_string(kSamples) + ",\n  \"results\": [\n";
+    for (size_t r = 0; r < results.size(); ++r) {
+        const Result& result = results[r];
+        double mean = 0;
+        for (double sample : result.samples) {
+            mean += sample / static_cast<double>(result.samples.size());
+        }
+        json += "    {\"pointer\": \"" + result.pointer + "\", \"operation\": \"" +
+                result.operation + "\", \"mean\": " + std::to_string(mean);
+        for (int p : {50, 90, 99}) {
+            json += ", \"p" + std::to_string(p) +
+                    "\": " + std::to_string(Percentile(result.samples, p));
+        }
+        json += ", \"min\": " + std::to_string(Percentile(result.samples, 0)) +
+                ", \"max\": " + std::to_string(Percentile(result.samples, 100));
+        json += r + 1 == results.size() ? "}\n" : "},\n";
+    }
+    return json + "  ]\n}\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::thread([] {}).join();
+
+    auto new_payload = [](size_t) { return new Payload; };
+
+    // UniquePtr
+    using Unique = UniquePtr<Payload>;
+    using StdUnique = std::unique_ptr<Payload>;
+    auto unique = [](size_t) { return Unique(new Payload); };
+    auto std_unique = [](size_t) { return StdUnique(new Payload); };
+    TimeConstruct<Unique>("UniquePtr", "construct", unique);
+    TimeConstruct<StdUnique>("std::unique_ptr", "construct", std_unique);
+    TimeMove<Unique>("UniquePtr", unique);
+    TimeMove<StdUnique>("std::unique_ptr", std_unique);
+    TimeDestroy<Unique>("UniquePtr", unique);
+    TimeDestroy<StdUnique>("std::unique_ptr", std_unique);
+    TimeDereference<Unique>("UniquePtr", unique);
+    TimeDereference<StdUnique>("std::unique_ptr", std_unique);
+
+    // SharedPtr
+    using Shared = SharedPtr<Payload>;
+    using StdShared = std::shared_ptr<Payload>;
+    auto make_shared = [](size_t) { return MakeShared<Payload>(); };
+    auto std_make_shared = [](size_t) { return std::make_shared<Payload>(); };
+    TimeConstruct<Shared>("SharedPtr", "construct",
+                          [&](size_t i) { return Shared(new_payload(i)); });
+    TimeConstruct<StdShared>("std::shared_ptr", "construct",
+                             [&](size_t i) { return StdShared(new_payload(i)); });
+    TimeConstruct<Shared>("SharedPtr", "MakeShared", make_shared);
+    TimeConstruct<StdShared>("std::shared_ptr", "MakeShared", std_make_shared);
+    TimeCopy<Shared>("SharedPtr", make_shared);
+    TimeCopy<StdShared>("std::shared_ptr", std_make_shared);
+    TimeMove<Shared>("SharedPtr", make_shared);
+    TimeMove<StdShared>("std::shared_ptr", std_make_shared);
+    TimeDestroy<Shared>("SharedPtr", make_shared);
+    TimeDestroy<StdShared>("std::shared_ptr", std_make_shared);
+    TimeDereference<Shared>("SharedPtr", make_shared);
+    TimeDereference<StdShared>("std::shared_ptr", std_make_shared);
+
+    // LocalSharedPtr, the same operations without atomics
+    using LocalShared = LocalSharedPtr<Payload>;
+    auto make_local_shared = [](size_t) { return MakeLocalShared<Payload>(); };
+    TimeConstruct<LocalShared>("LocalSharedPtr", "MakeShared", make_local_shared);
+    TimeCopy<LocalShared>("LocalSharedPtr", make_local_shared);
+    TimeDestroy<LocalShared>("LocalSharedPtr", make_local_shared);
+
+    // WeakPtr, observing owners that stay alive throughout
+    using Weak = WeakPtr<Payload>;
+    using StdWeak = std::weak_ptr<Payload>;
+    std::vector<Shared> owners;
+    std::vector<StdShared> std_owners;
+    for (size_t i = 0; i < kBatch; ++i) {
+        owners.push_back(MakeShared<Payload>());
+        std_owners.push_back(std::make_shared<Payload>());
+    }
+    auto weak = [&](size_t i) { return Weak(owners[i]); };
+    auto std_weak = [&](size_t i) { return StdWeak(std_owners[i]); };
+    TimeConstruct<Weak>("WeakPtr", "construct", weak);
+    TimeConstruct<StdWeak>("std::weak_ptr", "construct", std_weak);
+    TimeCopy<Weak>("WeakPtr", weak);
+    TimeCopy<StdWeak>("std::weak_ptr", std_weak);
+    TimeMove<Weak>("WeakPtr", weak);
+    TimeMove<StdWeak>("std::weak_ptr", std_weak);
+    TimeDestroy<Weak>("WeakPtr", weak);
+    TimeDestroy<StdWeak>("std::weak_ptr", std_weak);
+    TimeUse<Weak>("WeakPtr", "Lock", weak, [](const Weak& ptr) { DoNotOptimize(ptr.Lock()); });
+    TimeUse<StdWeak>("std::weak_ptr", "Lock", std_weak,
+                     [](const StdWeak& ptr) { DoNotOptimize(ptr.lock()); });
+
+    // IntrusivePtr
+    using Intrusive = IntrusivePtr<IntrusivePayload>;
+    auto make_intrusive = [](size_t) { return MakeIntrusive<IntrusivePayload>(); };
+    TimeConstruct<Intrusive>("IntrusivePtr", "construct",
+                             [](size_t) { return Intrusive(new IntrusivePayload); });
+    TimeConstruct<Intrusive>("IntrusivePtr", "MakeIntrusive", make_intrusive);
+    TimeCopy<Intrusive>("IntrusivePtr", make_intrusive);
+    TimeMove<Intrusive>("IntrusivePtr", make_intrusive);
+    TimeDestroy<Intrusive>("IntrusivePtr", make_intrusive);
+    TimeDereference<Intrusive>("IntrusivePtr", make_intrusive);
+
+    std::cout << "pointer\toperation\tp50 ns/op\tp90\tp99\n";
+    for (const Result& result : results) {
+        std::cout << result.pointer << "\t" << result.operation << "\t"
+                  << Percentile(result.samples, 50) << "\t" << Percentile(result.samples, 90)
+                  << "\t" << Percentile(result.samples, 99) << "\n";
+    }
+
+    const char* path = argc > 1 ? argv[1] : "bench_pointers.json";
+    std::ofstream(path) << Json();
+    std::cout << "wrote " << path << "\n";
+    return 0;
+}
@@ -0,0 +1,82 @@
+#include <weak/shared.h>
+#include <weak/weak.h>
+
+#include "bench.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Latency of requests that drop the last reference to a large object, with the destructor run
+// inline and with it deferred to the background reclaimer. A request touches its object and
+// releases it; every kHeavyEvery-th object is large (kHeavyStrings heap strings), the rest are
+// small. Each request is timed on its own, and the table shows percentiles in ns.
+// Built with SHARED_PTR_DEFERRED_RECLAMATION.
+
+namespace {
+
+constexpr size_t kRequests = 1 << 16;
+constexpr size_t kHeavyEvery = 64;
+constexpr size_t kHeavyStrings = 2000;
+
+struct Document {
+    std::vector<std::string> lines;
+};
+
+std::vector<SharedPtr<Document>> MakeDocuments() {
+    std::vector<SharedPtr<Document>> documents;
+    documents.reserve(kRequests);
+    for (size_t i = 0; i < kRequests; ++i) {
+        auto document = MakeShared<Document>();
+        size_t lines = i % kHeavyEvery == 0 ? kHeavyStrings : 1;
+        for (size_t line = 0; line < lines; ++line) {
+            document->lines.push_back(std::string(40, 'x'));
+        }
+        documents.push_back(std::move(document));
+    }
+    return documents;
+}
+
+std::vector<double> TimeRequests(std::vector<SharedPtr<Document>> documents) {
+    std::vector<double> latencies;
+    latencies.reserve(kRequests);
+    for (auto& document : documents) {
+        auto start = std::chrono::steady_clock::now();
+        DoNotOptimize(document->lines.size());
+        document.Reset();
+        std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        latencies.push_back(elapsed.count());
+    }
+    return latencies;
+}
+
+void Print(const char* name, const std::vector<double>& latencies) {
+    std::cout << name;
+    for (double p : {50.0, 90.0, 99.0, 99.9, 100.0}) {
+        std::cout << "\t" << Percentile(latencies, p);
+    }
+    std::cout << "\n";
+}
+
+}  // namespace
+
+int main() {
+    using Reclaimer = EpochReclaimer<BlockBase>;
+
+    std::cout << std::fixed << std::setprecision(0);
+    std::cout << "release\tp50 ns\tp90\tp99\tp99.9\tmax\n";
+
+    Print("inline", TimeRequests(MakeDocuments()));
+
+    Reclaimer::Start(std::chrono::milliseconds(1));
+    std::vector<double> deferred;
+    {
+        DeferReleases defer;
+        deferred = TimeRequests(MakeDocuments());
+    }
+    Reclaimer::Stop();
+    Print("deferred", deferred);
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <weak/shared.h>
+
+#include <malloc.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Clearing a vector of SharedPtr-s in which every object appears `copies` times, in random
+// order, like a column of interned strings. The vector holds the only references, so every
+// object is destroyed. Columns: milliseconds to clear kPointers pointers by destroying them
+// one by one, with ReleaseN (which only merges neighbours), and with ReleaseAll on one and on
+// all CPUs. Each time includes a malloc_trim: glibc merges freed small chunks when a large one
+// is freed, which ReleaseAll's table triggers and a plain clear() leaves to the next
+// allocation, so without it the columns would not pay for the same work.
+
+namespace {
+
+constexpr size_t kPointers = 1 << 20;
+
+using Column = std::vector<SharedPtr<std::string>>;
+
+Column MakeColumn(size_t copies) {
+    Column column;
+    column.reserve(kPointers);
+    for (size_t i = 0; i < kPointers / copies; ++i) {
+        auto value = MakeShared<std::string>(32, static_cast<char>('a' + i % 26));
+        for (size_t c = 0; c < copies; ++c) {
+            column.push_back(value);
+        }
+    }
+    std::shuffle(column.begin(), column.end(), std::mt19937_64(copies));
+    return column;
+}
+
+double Milliseconds(size_t copies, const std::function<void(Column&)>& clear) {
+    Column column = MakeColumn(copies);
+    auto start = std::chrono::steady_clock::now();
+    clear(column);
+    malloc_trim(0);
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+}  // namespace
+
+int main() {
+    size_t cpus = std::max(1u, std::thread::hardware_concurrency());
+
+    std::cout << kPointers << " pointers\n";
+    std::cout << "copies/object\tone by one ms\tReleaseN ms\tReleaseAll ms\tReleaseAll x" << cpus
+              << " ms\n"
+              << std::fixed << std::setprecision(1);
+    for (size_t copies : {1, 2, 8, 64, 1024}) {
+        std::cout << copies << "\t"
+                  << Milliseconds(copies, [](Column& column) { column.clear(); }) << "\t"
+                  << Milliseconds(copies,
+                                  [](Column& column) { ReleaseN(column.begin(), column.end()); })
+                  << "\t"
+                  << Milliseconds(copies,
+                                  [](Column& column) { ReleaseAll(column.begin(), column.end()); })
+                  << "\t" << Milliseconds(copies, [cpus](Column& column) {
+                         ReleaseAll(column.begin(), column.end(), cpus);
+                     }) << "\n";
+    }
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include <weak/shared.h>
+#include <weak/weak.h>
+#include <weak/weak_value_cache.h>
+
+#include "bench.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// WeakValueCache next to the structure it replaces: one unordered_map of WeakPtr-s behind one
+// mutex, swept in full every kSweepPeriod insertions. 90% of the operations look up one of
+// kHotKeys values that stay alive throughout, 10% create a value under a fresh key; a thread
+// keeps its last kHeld created values alive, the older ones expire in the cache.
+// Prints Mops/s for 1..N threads and the entries left in each cache, expired ones included.
+// N is the first argument, the number of CPUs by default.
+
+namespace {
+
+constexpr size_t kIterations = 1 << 19;
+constexpr uint64_t kHotKeys = 1024;
+constexpr size_t kHeld = 256;
+constexpr size_t kSweepPeriod = 4096;
+
+struct Value {
+    uint64_t key = 0;
+    char payload[48] = {};
+};
+
+class MutexCache {
+public:
+    template <typename Factory>
+    SharedPtr<Value> GetOrCreate(uint64_t key, Factory factory) {
+        std::lock_guard lock(mutex_);
+        WeakPtr<Value>& entry = map_[key];
+        if (SharedPtr<Value> value = entry.Lock()) {
+            return value;
+        }
+        SharedPtr<Value> value = factory();
+        entry = value;
+        if (++inserts_ % kSweepPeriod == 0) {
+            std::erase_if(map_, [](const auto& item) { return item.second.Expired(); });
+        }
+        return value;
+    }
+
+    size_t Size() {
+        std::lock_guard lock(mutex_);
+        return map_.size();
+    }
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<uint64_t, WeakPtr<Value>> map_;
+    size_t inserts_ = 0;
+};
+
+// xorshift64, cheap enough not to show up in the numbers
+uint64_t Next(uint64_t& state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
+
+// Runs the 90/10 mix on `threads` threads and returns the total throughput in Mops/s
+template <typename Cache>
+double Throughput(Cache& cache, size_t threads) {
+    static std::atomic<uint64_t> fresh_keys = kHotKeys;
+    std::atomic<size_t> ready = 0;
+    std::atomic<bool> start = false;
+    std::vector<std::thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            uint64_t state = 0x9E3779B97F4A7C15ull * (t + 1);
+            std::vector<SharedPtr<Value>> held(kHeld);
+            size_t next_held = 0;
+            ++ready;
+            while (!start.load()) {
+            }
+            for (size_t i = 0; i < kIterations; ++i) {
+                uint64_t r = Next(state);
+                uint64_t key = r % 10 == 0 ? fresh_keys.fetch_add(1, std::memory_order_relaxed)
+                                           : (r >> 8) % kHotKeys;
+                auto value = cache.GetOrCreate(key, [key] { return MakeShared<Value>(Value{key}); });
+                DoNotOptimize(value->key);
+                if (key >= kHotKeys) {
+                    held[next_held++ % kHeld] = std::move(value);
+                }
+            }
+        });
+    }
+    while (ready.load() != threads) {
+    }
+    auto begin = std::chrono::steady_clock::now();
+    start = true;
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - begin;
+    return static_cast<double>(threads * kIterations) / elapsed.count();
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t max_threads = argc > 1 ? std::stoul(argv[1]) : std::thread::hardware_concurrency();
+
+    std::vector<SharedPtr<Value>> hot;
+    auto fill = [&hot](auto& cache) {
+        for (uint64_t key = 0; key < kHotKeys; ++key) {
+            hot.push_back(cache.GetOrCreate(key, [key] { return MakeShared<Value>(Value{key}); }));
+        }
+    };
+
+    std::cout << "90% hits on " << kHotKeys << " live keys, 10% creations\n";
+    std::cout << "threads\tMutexCache Mops/s\tWeakValueCache Mops/s\n" << std::fixed
+              << std::setprecision(1);
+    size_t mutex_size = 0;
+    size_t striped_size = 0;
+    for (size_t threads = 1; threads <= max_threads; ++threads) {
+        MutexCache mutex_cache;
+        WeakValueCache<uint64_t, Value> striped_cache;
+        fill(mutex_cache);
+        fill(striped_cache);
+        double mutex_mops = Throughput(mutex_cache, threads);
+        double striped_mops = Throughput(striped_cache, threads);
+        std::cout << threads << "\t" << mutex_mops << "\t" << striped_mops << "\n";
+        mutex_size = mutex_cache.Size();
+        striped_size = striped_cache.Size();
+        hot.clear();
+    }
+    std::cout << "entries left: MutexCache " << mutex_size << ", WeakValueCache " << striped_size
+              << "\n";
+    return 0;
+}
@@ -0,0 +1,33 @@
+#include <weak/shared.h>
+
+#include <iostream>
+#include <string>
+
+// Static report of control block sizes: bytes allocated per MakeShared<T>
+// (block and object together) and per SharedPtr(new T) (block only, the object is separate).
+
+namespace {
+
+struct Bytes64 {
+    char data[64];
+};
+
+template <typename T>
+void Report(const char* name) {
+    std::cout << name << "\t" << sizeof(T) << "\t" << sizeof(AllocatedByOurselves<T>) << "\t"
+              << sizeof(AllocatedByUser<T>) << "\t" << sizeof(AllocatedByUser<T>) + sizeof(T)
+              << "\n";
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "T\tsizeof(T)\tMakeShared<T> block\tSharedPtr(new T) block\t"
+                 "SharedPtr(new T) block+object\n";
+    Report<char>("char");
+    Report<int>("int");
+    Report<double>("double");
+    Report<std::string>("std::string");
+    Report<Bytes64>("char[64]");
+    return 0;
+}
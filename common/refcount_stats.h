@@ -0,0 +1,295 @@
+#pragma once
+
+// Reference-count traffic of SharedPtr, WeakPtr, IntrusivePtr and UniquePtr, keyed by pointee
+// type. Only compiled in with SMART_PTR_INSTRUMENTATION; without it this header defines nothing
+// but the SMART_PTR_RECORD hooks, which expand to nothing. Every thread counts into its own table
+// with plain stores (atomic only so that snapshots may read them), and TakeRefCountSnapshot()
+// adds them up. Recording never throws, since the hooks sit in noexcept constructors and
+// resets: an event that would need memory the allocator cannot give is dropped.
+#ifndef SMART_PTR_INSTRUMENTATION
+#ifndef SMART_PTR_RECORD
+#define SMART_PTR_RECORD(Type, event)
+#define SMART_PTR_RECORD_SLOT(slot, event)
+#endif
+#else
+
+#include <common/type_name.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+enum class RefEvent {
+    kAllocation,  // control block (or intrusive/unique object) created
+    kStrongInc,
+    kStrongDec,
+    kWeakInc,
+    kWeakDec,
+    kPromotion,    // WeakPtr::Lock or SharedPtr(WeakPtr) that succeeded
+    kDestruction,  // the object itself destroyed
+    kCount
+};
+
+struct RefCountStats {
+    uint64_t allocations = 0;
+    uint64_t strong_increments = 0;
+    uint64_t strong_decrements = 0;
+    uint64_t weak_increments = 0;
+    uint64_t weak_decrements = 0;
+    uint64_t promotions = 0;
+    uint64_t destructions = 0;
+
+    // Increments and decrements of either kind: the atomic RMWs paid for
+    uint64_t CounterOps() const {
+        return strong_increments + strong_decrements + weak_increments + weak_decrements;
+    }
+
+    uint64_t& operator[](RefEvent event) {
+        return this->*kFields[static_cast<size_t>(event)];
+    }
+    uint64_t operator[](RefEvent event) const {
+        return this->*kFields[static_cast<size_t>(event)];
+    }
+
+    RefCountStats& operator+=(const RefCountStats& other) {
+        for (auto field : kFields) {
+            this->*field += other.*field;
+        }
+        return *this;
+    }
+
+    RefCountStats operator-(const RefCountStats& other) const {
+        RefCountStats result = *this;
+        for (auto field : kFields) {
+            result.*field -= other.*field;
+        }
+        return result;
+    }
+
+    bool operator==(const RefCountStats&) const = default;
+
+    // In RefEvent order
+    static constexpr uint64_t RefCountStats::*kFields[] = {
+        &RefCountStats::allocations,     &RefCountStats::strong_increments,
+        &RefCountStats::strong_decrements, &RefCountStats::weak_increments,
+        &RefCountStats::weak_decrements, &RefCountStats::promotions,
+        &RefCountStats::destructions};
+};
+
+// Pointee type name -> counts, summed over all threads, live and exited
+using RefCountSnapshot = std::map<std::string, RefCountStats>;
+
+class RefCountRegistry {
+public:
+    using Slot = uint32_t;
+
+    static constexpr size_t kChunkSize = 64;
+    static constexpr size_t kMaxChunks = 256;
+    static constexpr size_t kMaxSlots = kChunkSize * kMaxChunks;
+    // Counts of the types that did not get a slot of their own, under kOtherName in snapshots
+    static constexpr Slot kOtherSlot = 0;
+    static constexpr std::string_view kOtherName = "(other types)";
+
+    template <class T>
+    static Slot SlotOf() noexcept {
+        static const Slot slot = Register(NameOf<T>());
+        return slot;
+    }
+
+    // The key of `T` in snapshots
+    template <class T>
+    static std::string_view NameOf() {
+        return TypeName<T>();
+    }
+
+    static void Record(Slot slot, RefEvent event) noexcept {
+        if (local == nullptr) {
+            RecordSlow(slot, event);
+            return;
+        }
+        if (std::atomic<uint64_t>* counter = local->Counter(slot, event)) {
+            counter->store(counter->load(std::memory_order_relaxed) + 1,
+                           std::memory_order_relaxed);
+        }
+    }
+
+    static RefCountSnapshot Snapshot() {
+        std::lock_guard lock(Mutex());
+        std::vector<RefCountStats> totals = Retired();
+        for (ThreadTable* table : Tables()) {
+            table->AddTo(totals);
+        }
+        // Tables cover whole chunks, only the registered part of them means anything
+        totals.resize(Names().size());
+        RefCountSnapshot snapshot;
+        for (Slot slot = 0; slot < totals.size(); ++slot) {
+            if (!(totals[slot] == RefCountStats{})) {
+                snapshot[Names()[slot]] += totals[slot];
+            }
+        }
+        return snapshot;
+    }
+
+private:
+    using Counters = std::array<std::atomic<uint64_t>, static_cast<size_t>(RefEvent::kCount)>;
+
+    struct Chunk {
+        Counters counters[kChunkSize] = {};
+    };
+
+    // Written by its thread only; chunks are published with a release store for snapshots
+    class ThreadTable {
+    public:
+        ThreadTable() {
+            std::lock_guard lock(Mutex());
+            Tables().push_back(this);
+        }
+
+        ~ThreadTable() {
+            std::lock_guard lock(Mutex());
+            try {
+                AddTo(Retired());
+            } catch (const std::bad_alloc&) {
+                // The counts of this thread are lost
+            }
+            std::erase(Tables(), this);
+            for (auto& chunk : chunks_) {
+                delete chunk.load(std::memory_order_relaxed);
+            }
+        }
+
+        // Null if the chunk of `slot` cannot be allocated
+        std::atomic<uint64_t>* Counter(Slot slot, RefEvent event) noexcept {
+            std::atomic<Chunk*>& chunk = chunks_[slot / kChunkSize];
+            Chunk* current = chunk.load(std::memory_order_relaxed);
+            if (current == nullptr) {
+                current = new (std::nothrow) Chunk;
+                if (current == nullptr) {
+                    return nullptr;
+                }
+                chunk.store(current, std::memory_order_release);
+            }
+            return &current->counters[slot % kChunkSize][static_cast<size_t>(event)];
+        }
+
+        // Called under the registry mutex
+        void AddTo(std::vector<RefCountStats>& totals) const {
+            for (size_t c = 0; c < kMaxChunks; ++c) {
+                Chunk* chunk = chunks_[c].load(std::memory_order_acquire);
+                if (chunk == nullptr) {
+                    continue;
+                }
+                for (size_t i = 0; i < kChunkSize; ++i) {
+                    Slot slot = c * kChunkSize + i;
+                    if (slot >= totals.size()) {
+                        totals.resize(slot + 1);
+                    }
+                    for (size_t e = 0; e < static_cast<size_t>(RefEvent::kCount); ++e) {
+                        totals[slot][static_cast<RefEvent>(e)] +=
+                            chunk->counters[i][e].load(std::memory_order_relaxed);
+                    }
+                }
+            }
+        }
+
+    private:
+        std::array<std::atomic<Chunk*>, kMaxChunks> chunks_ = {};
+    };
+
+    // Types past kMaxSlots, or whose name cannot be stored, share kOtherSlot
+    static Slot Register(std::string_view name) noexcept {
+        std::lock_guard lock(Mutex());
+        try {
+            if (Names().size() >= kMaxSlots) {
+                return kOtherSlot;
+            }
+            Names().emplace_back(name);
+        } catch (const std::bad_alloc&) {
+            return kOtherSlot;
+        }
+        return static_cast<Slot>(Names().size() - 1);
+    }
+
+    struct ExitGuard {
+        ~ExitGuard() {
+            delete local;
+            local = nullptr;
+            exited = true;
+        }
+    };
+
+    static void RecordSlow(Slot slot, RefEvent event) noexcept {
+        if (!exited) {
+            static thread_local ExitGuard exit_guard;
+            try {
+                local = new ThreadTable;
+                Record(slot, event);
+                return;
+            } catch (const std::bad_alloc&) {
+                // Counted into the totals below, the next event tries again
+            }
+        }
+        // Pointers destroyed after this thread's table went away count straight into the totals
+        std::lock_guard lock(Mutex());
+        try {
+            if (Retired().size() <= slot) {
+                Retired().resize(slot + 1);
+            }
+        } catch (const std::bad_alloc&) {
+            return;
+        }
+        ++Retired()[slot][event];
+    }
+
+    static inline constinit thread_local ThreadTable* local = nullptr;
+    static inline constinit thread_local bool exited = false;
+
+    // Function-local statics, so that they outlive the thread tables of the main thread
+    static std::mutex& Mutex() {
+        static std::mutex* mutex = new std::mutex;
+        return *mutex;
+    }
+    static std::vector<std::string>& Names() {
+        static auto* names = new std::vector<std::string>{std::string(kOtherName)};
+        return *names;
+    }
+    static std::vector<ThreadTable*>& Tables() {
+        static auto* tables = new std::vector<ThreadTable*>;
+        return *tables;
+    }
+    // Counts of threads that have exited
+    static std::vector<RefCountStats>& Retired() {
+        static auto* retired = new std::vector<RefCountStats>;
+        return *retired;
+    }
+};
+
+inline RefCountSnapshot TakeRefCountSnapshot() {
+    return RefCountRegistry::Snapshot();
+}
+
+// What happened between two snapshots, e.g. around a request handler
+inline RefCountSnapshot operator-(const RefCountSnapshot& after, const RefCountSnapshot& before) {
+    RefCountSnapshot diff;
+    for (const auto& [name, stats] : after) {
+        auto it = before.find(name);
+        RefCountStats delta = it == before.end() ? stats : stats - it->second;
+        if (!(delta == RefCountStats{})) {
+            diff[name] = delta;
+        }
+    }
+    return diff;
+}
+
+#define SMART_PTR_RECORD_SLOT(slot, event) RefCountRegistry::Record(slot, RefEvent::event)
+#define SMART_PTR_RECORD(Type, event) \
+    RefCountRegistry::Record(RefCountRegistry::SlotOf<Type>(), RefEvent::event)
+
+#endif
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <source_location>
+#include <string_view>
+
+// Readable name of `T` without RTTI, e.g. "int" or "Widget<char>"
+template <class T>
+std::string_view TypeName() {
+    // "... [with T = Foo; ...]" on GCC, "... [T = Foo]" on Clang
+    std::string_view name = std::source_location::current().function_name();
+    size_t begin = name.find("T = ") + 4;
+    size_t end = name.find_first_of(";]", begin);
+    return name.substr(begin, end - begin);
+}
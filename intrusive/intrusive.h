@@ -1,7 +1,12 @@
 #pragma once
 
-#include <cstddef>  // for std::nullptr_t
-#include <utility>  // for std::exchange / std::swap
+#include <cstddef>   // for std::nullptr_t
+#include <iterator>  // for std::back_inserter
+#include <utility>   // for std::exchange / std::swap
+#include <vector>
+
+// Build with SMART_PTR_INSTRUMENTATION to count objects and counter updates per pointee type
+#include <common/refcount_stats.h>
 
 class SimpleCounter {
 public:
@@ -13,6 +18,14 @@ public:
         --count_;
         return count_;
     };
+    size_t IncRef(size_t n) {
+        count_ += n;
+        return count_;
+    };
+    size_t DecRef(size_t n) {
+        count_ -= n;
+        return count_;
+    };
     size_t RefCount() const {
         return count_;
     };
@@ -31,16 +44,51 @@ struct DefaultDelete {
 template <typename Derived, typename Counter, typename Deleter>
 class RefCounted {
 public:
+#ifdef SMART_PTR_INSTRUMENTATION
+    RefCounted() {
+        SMART_PTR_RECORD(Derived, kAllocation);
+    }
+#endif
+
     // Increase reference counter.
     void IncRef() {
+        SMART_PTR_RECORD(Derived, kStrongInc);
         counter_.IncRef();
     };
 
     // Decrease reference counter.
     // Destroy object using Deleter when the last instance dies.
     void DecRef() {
+        SMART_PTR_RECORD(Derived, kStrongDec);
         counter_.DecRef();
         if (counter_.RefCount() == 0) {
+            SMART_PTR_RECORD(Derived, kDestruction);
+            Deleter::Destroy(static_cast<Derived*>(this));
+        };
+    };
+
+    // `n` references at once; one counter update if the Counter has IncRef(n)/DecRef(n)
+    void IncRef(size_t n) {
+        SMART_PTR_RECORD(Derived, kStrongInc);
+        if constexpr (requires(Counter counter) { counter.IncRef(n); }) {
+            counter_.IncRef(n);
+        } else {
+            for (size_t i = 0; i < n; ++i) {
+                counter_.IncRef();
+            }
+        }
+    };
+    void DecRef(size_t n) {
+        SMART_PTR_RECORD(Derived, kStrongDec);
+        if constexpr (requires(Counter counter) { counter.DecRef(n); }) {
+            counter_.DecRef(n);
+        } else {
+            for (size_t i = 0; i < n; ++i) {
+                counter_.DecRef();
+            }
+        }
+        if (counter_.RefCount() == 0) {
+            SMART_PTR_RECORD(Derived, kDestruction);
             Deleter::Destroy(static_cast<Derived*>(this));
         };
     };
@@ -61,10 +109,42 @@ private:
 template <typename Derived, typename D = DefaultDelete>
 using SimpleRefCounted = RefCounted<Derived, SimpleCounter, D>;
 
+template <typename Ptr>
+inline constexpr bool kIsIntrusivePtr = false;
+template <typename T>
+class IntrusivePtr;
+template <typename T>
+inline constexpr bool kIsIntrusivePtr<IntrusivePtr<T>> = true;
+
+// `n` references to `object` at once, one by one if it has no batched IncRef/DecRef
+template <typename T>
+void IncRefN(T* object, size_t n) {
+    if constexpr (requires { object->IncRef(n); }) {
+        object->IncRef(n);
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            object->IncRef();
+        }
+    }
+}
+template <typename T>
+void DecRefN(T* object, size_t n) {
+    if constexpr (requires { object->DecRef(n); }) {
+        object->DecRef(n);
+    } else {
+        for (size_t i = 0; i < n; ++i) {
+            object->DecRef();
+        }
+    }
+}
+
 template <typename T>
 class IntrusivePtr {
     template <typename Y>
     friend class IntrusivePtr;
+    template <std::forward_iterator It>
+    requires kIsIntrusivePtr<std::iter_value_t<It>>
+    friend void ReleaseN(It first, It last);
 
 public:
     // Constructors
@@ -91,13 +171,9 @@ public:
         }
     };
 
+    // Moves take the reference over from `other`, so they never touch the counter
     template <typename Y>
-    IntrusivePtr(IntrusivePtr<Y>&& other) {
-        ptr_ = other.Get();
-        if (ptr_ != nullptr) {
-            ptr_->IncRef();
-        }
-        other.Reset();
+    IntrusivePtr(IntrusivePtr<Y>&& other) noexcept : ptr_(std::exchange(other.ptr_, nullptr)) {
     };
 
     IntrusivePtr(const IntrusivePtr& other) {
@@ -106,12 +182,7 @@ public:
             ptr_->IncRef();
         }
     };
-    IntrusivePtr(IntrusivePtr&& other) {
-        ptr_ = other.Get();
-        if (ptr_ != nullptr) {
-            ptr_->IncRef();
-        }
-        other.Reset();
+    IntrusivePtr(IntrusivePtr&& other) noexcept : ptr_(std::exchange(other.ptr_, nullptr)) {
     };
 
     template <typename... Args>
@@ -137,18 +208,9 @@ public:
         }
         return *this;
     };
-    IntrusivePtr& operator=(IntrusivePtr&& other) {
-        if (ptr_ == other.Get()) {
-            return *this;
-        }
-        if (ptr_ != nullptr) {
-            ptr_->DecRef();
-        }
-        ptr_ = other.Get();
-        if (ptr_ != nullptr) {
-            ptr_->IncRef();
-        }
-        other.Reset();
+    // The old reference is released by the temporary
+    IntrusivePtr& operator=(IntrusivePtr&& other) noexcept {
+        IntrusivePtr(std::move(other)).Swap(*this);
         return *this;
     };
 
@@ -181,6 +243,42 @@ public:
         }
     };
 
+    // Batches
+
+    // Writes `n` new owners of the object to `out`, taking their references with one counter
+    // update; see RefCounted::IncRef(n). ReleaseN gives such a batch back the same way.
+    template <class OutputIt>
+    OutputIt ShareN(size_t n, OutputIt out) const {
+        if (ptr_ == nullptr || n == 0) {
+            for (size_t i = 0; i < n; ++i, ++out) {
+                *out = IntrusivePtr();
+            }
+            return out;
+        }
+        IncRefN(ptr_, n);
+        size_t handed = 0;
+        try {
+            for (; handed < n; ++handed, ++out) {
+                // If the write throws, the temporary still drops its own reference
+                *out = IntrusivePtr(AdoptRef{}, ptr_);
+            }
+        } catch (...) {
+            if (handed + 1 < n) {
+                // `*this` still owns one, so this never destroys the object
+                DecRefN(ptr_, n - handed - 1);
+            }
+            throw;
+        }
+        return out;
+    };
+
+    std::vector<IntrusivePtr> ShareN(size_t n) const {
+        std::vector<IntrusivePtr> shared;
+        shared.reserve(n);
+        ShareN(n, std::back_inserter(shared));
+        return shared;
+    };
+
     // Observers
     T* Get() const {
         return ptr_;
@@ -209,10 +307,34 @@ public:
     };
 
 private:
+    struct AdoptRef {};
+
+    // Takes over a reference that was already counted
+    IntrusivePtr(AdoptRef, T* ptr) : ptr_(ptr) {
+    };
+
     T* ptr_;
     // RefCounted ref_count_;
 };
 
+// Empties the pointers in [first, last); every run of consecutive pointers to one object drops
+// its references with one counter update, so a batch made by ShareN costs one in total
+template <std::forward_iterator It>
+requires kIsIntrusivePtr<std::iter_value_t<It>>
+void ReleaseN(It first, It last) {
+    while (first != last) {
+        auto* object = first->ptr_;
+        size_t run = 0;
+        for (; first != last && first->ptr_ == object; ++first) {
+            first->ptr_ = nullptr;
+            ++run;
+        }
+        if (object != nullptr) {
+            DecRefN(object, run);
+        }
+    }
+};
+
 template <typename T, typename... Args>
 IntrusivePtr<T> MakeIntrusive(Args&&... args) {
     IntrusivePtr<T> ptr(true, std::forward<Args>(args)...);
@@ -4,7 +4,9 @@
 
 #include "allocations_checker.h"
 
+#include <iterator>
 #include <string>
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////////////
 
@@ -397,3 +399,97 @@ TEST_CASE("Object pool") {
         REQUIRE(strs.NumInUse() == 1);
     }
 }
+
+class CountingCounter : public SimpleCounter {
+public:
+    static inline int updates = 0;
+
+    size_t IncRef() {
+        ++updates;
+        return SimpleCounter::IncRef();
+    };
+    size_t DecRef() {
+        ++updates;
+        return SimpleCounter::DecRef();
+    };
+    size_t IncRef(size_t n) {
+        ++updates;
+        return SimpleCounter::IncRef(n);
+    };
+    size_t DecRef(size_t n) {
+        ++updates;
+        return SimpleCounter::DecRef(n);
+    };
+};
+
+struct Message : public RefCounted<Message, CountingCounter, DefaultDelete> {
+    int id = 0;
+};
+
+// Only single-step updates, so batches fall back to loops
+class StepCounter {
+public:
+    size_t IncRef() {
+        return ++count_;
+    };
+    size_t DecRef() {
+        return --count_;
+    };
+    size_t RefCount() const {
+        return count_;
+    };
+
+private:
+    size_t count_ = 0;
+};
+
+struct Legacy : public RefCounted<Legacy, StepCounter, DefaultDelete> {};
+
+TEST_CASE("ShareN and ReleaseN") {
+    SECTION("One counter update per batch") {
+        auto message = MakeIntrusive<Message>();
+        std::vector<IntrusivePtr<Message>> subscribers;
+        subscribers.reserve(16);
+        CountingCounter::updates = 0;
+        message.ShareN(16, std::back_inserter(subscribers));
+        REQUIRE(CountingCounter::updates == 1);
+        REQUIRE(message.UseCount() == 17);
+        REQUIRE(subscribers[15].Get() == message.Get());
+
+        ReleaseN(subscribers.begin(), subscribers.end());
+        REQUIRE(CountingCounter::updates == 2);
+        REQUIRE(message.UseCount() == 1);
+        REQUIRE(subscribers[0].Get() == nullptr);
+    }
+
+    SECTION("Moves touch no counters") {
+        auto message = MakeIntrusive<Message>();
+        CountingCounter::updates = 0;
+        IntrusivePtr<Message> moved = std::move(message);
+        message = std::move(moved);
+        auto batch = message.ShareN(8);
+        batch.reserve(batch.capacity() * 4);
+        REQUIRE(CountingCounter::updates == 1);
+        ReleaseN(batch.begin(), batch.end());
+        REQUIRE(message.UseCount() == 1);
+    }
+
+    SECTION("Counters without batches") {
+        IntrusivePtr<Legacy> a(new Legacy);
+        IntrusivePtr<MyString> b(new MyString("b"));
+        auto legacy = a.ShareN(3);
+        auto strings = b.ShareN(2);
+        REQUIRE(a.UseCount() == 4);
+        ReleaseN(legacy.begin(), legacy.end());
+        ReleaseN(strings.begin(), strings.end());
+        REQUIRE(a.UseCount() == 1);
+        REQUIRE(b.UseCount() == 1);
+        REQUIRE(IntrusivePtr<MyInt>().ShareN(2).size() == 2);
+    }
+
+    SECTION("The last release destroys") {
+        auto batch = MakeIntrusive<MyString>("gone").ShareN(3);
+        ReleaseN(batch.begin(), batch.end());
+        REQUIRE(batch[1].Get() == nullptr);
+    }
+}
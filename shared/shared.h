@@ -2,32 +2,74 @@
 
 #include "sw_fwd.h"  // Forward declaration
 
+#include <atomic>
 #include <cstddef>  // std::nullptr_t
+#include <cstdint>
 #include <iostream>
-
+#include <memory>  // std::destroy_at
+#include <new>     // std::launder
+#include <type_traits>
+#include <utility>
+
+// Control block shared by every SharedPtr/WeakPtr of one object.
+// Counters live here once and are updated inline; the derived blocks only say how to destroy
+// the object and how to free the block, so a block is one vptr and two 32-bit counters.
+// Counters are atomic: increments are relaxed, decrements are release, and only the thread
+// that drops a counter to zero pays for an acquire (a load rather than a fence, which
+// ThreadSanitizer does not understand).
+// All strong references together own one weak reference, so the block is freed exactly once,
+// by whoever drops the weak counter to zero.
 class BlockBase {
 public:
     BlockBase() {
     }
-    virtual void IncCounter() {
-        ++count_;
+
+    void IncCounter() {
+        strong_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+    size_t GetCount() const {
+        return strong_count_.load(std::memory_order_relaxed);
+    }
+
+    void DecCounter() {
+        if (strong_count_.fetch_sub(1, std::memory_order_release) == 1) {
+            strong_count_.load(std::memory_order_acquire);
+            DestroyObject();
+            DecCounterWeak();
+        }
+    }
+
+    void IncCounterWeak() {
+        weak_count_.fetch_add(1, std::memory_order_relaxed);
     }
-    virtual size_t GetCount() {
-        return count_;
+    // Number of WeakPtr-s, not counting the reference held on behalf of the strong owners
+    size_t GetCountWeak() const {
+        return weak_count_.load(std::memory_order_relaxed) - (GetCount() > 0 ? 1 : 0);
     }
 
-    virtual void DecCounter() {
-        --count_;
+    void DecCounterWeak() {
+        if (weak_count_.fetch_sub(1, std::memory_order_release) == 1) {
+            weak_count_.load(std::memory_order_acquire);
+            Deallocate();
+        }
     }
 
-    virtual ~BlockBase(){};
+protected:
+    // Called once, when the last strong reference goes away
+    virtual void DestroyObject() = 0;
+    // Called once, when the last weak reference goes away; frees the block itself
+    virtual void Deallocate() = 0;
+
+    ~BlockBase() = default;
 
 private:
-    size_t count_ = 1;
+    // A fresh block is owned by the SharedPtr that created it
+    std::atomic<uint32_t> strong_count_ = 1;
+    std::atomic<uint32_t> weak_count_ = 1;
 };
 
 template <class T>
-class AllocatedByUser : public BlockBase {
+class AllocatedByUser final : public BlockBase {
 public:
     AllocatedByUser() {
         object_ = nullptr;
@@ -37,64 +79,41 @@ public:
         object_ = ptr;
     }
 
-    size_t GetCount() override {
-        return count_;
-    }
-
-    void IncCounter() override {
-        ++count_;
+private:
+    void DestroyObject() override {
+        delete object_;
+        object_ = nullptr;
     }
 
-    void DecCounter() override {
-        --count_;
-        if (count_ == 0) {
-            delete object_;
-            delete this;
-        }
+    void Deallocate() override {
+        delete this;
     }
 
-    ~AllocatedByUser() override{};
-
-private:
     T* object_;
-    size_t count_ = 1;
 };
 
 template <class T>
-class AllocatedByOurselves : public BlockBase {
+class AllocatedByOurselves final : public BlockBase {
 public:
     template <typename... Args>
     AllocatedByOurselves(Args&&... args) {
         ::new (&object_) T(std::forward<Args>(args)...);
     };
 
-    size_t GetCount() override {
-        return count_;
-    }
-
     T* GetObject() {
         return std::launder(reinterpret_cast<T*>(&object_));
     }
 
-    void IncCounter() override {
-        ++count_;
+private:
+    void DestroyObject() override {
+        std::destroy_at(GetObject());
     }
 
-    void DecCounter() override {
-        --count_;
-        if (count_ == 0) {
-            std::destroy_at(std::launder(reinterpret_cast<T*>(&object_)));
-            delete this;
-        }
+    void Deallocate() override {
+        delete this;
     }
-    ~AllocatedByOurselves() override {
-        std::destroy_at(std::launder(reinterpret_cast<T*>(&object_)));
-    };
 
-private:
     std::aligned_storage_t<sizeof(T), alignof(T)> object_;
-    // T object_;
-    size_t count_ = 1;
 };
 
 // https://en.cppreference.com/w/cpp/memory/shared_ptr
@@ -128,7 +147,7 @@ public:
     SharedPtr(const SharedPtr& other) {
         object_ = other.Get();
         block_ = other.block_;
-        if (Get() != nullptr) {
+        if (block_ != nullptr) {
             block_->IncCounter();
         }
     };
@@ -137,23 +156,25 @@ public:
     SharedPtr(const SharedPtr<Y>& other) {
         object_ = other.Get();
         block_ = other.GetBlock();
-        if (Get() != nullptr) {
+        if (block_ != nullptr) {
             block_->IncCounter();
         }
     };
 
+    // Moves take the reference over from `other`, so they never touch the counters
     template <class Y>
-    SharedPtr(SharedPtr<Y>&& other) {
-        object_ = other.Get();
-        block_ = other.GetBlock();
-        block_->IncCounter();
-        other.Reset();
+    SharedPtr(SharedPtr<Y>&& other) noexcept {
+        object_ = other.object_;
+        block_ = other.block_;
+        other.object_ = nullptr;
+        other.block_ = nullptr;
     };
 
-    SharedPtr(SharedPtr&& other) {
-        object_ = other.Get();
-        block_ = other.GetBlock();
-        block_->IncCounter();
+    SharedPtr(SharedPtr&& other) noexcept {
+        object_ = other.object_;
+        block_ = other.block_;
+        other.object_ = nullptr;
+        other.block_ = nullptr;
     };
 
     // Aliasing constructor
@@ -162,78 +183,79 @@ public:
     SharedPtr(const SharedPtr<Y>& other, T* ptr) {
         object_ = ptr;
         block_ = other.GetBlock();
-        block_->IncCounter();
+        if (block_ != nullptr) {
+            block_->IncCounter();
+        }
     };
 
     template <typename... Args>
     SharedPtr(bool f, Args&&... args) {
         AllocatedByOurselves<T>* block = new AllocatedByOurselves<T>(std::forward<Args>(args)...);
-        object_ = nullptr;
+        object_ = block->GetObject();
         block_ = block;
     };
 
     // Promote `WeakPtr`
     // #11 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
-    explicit SharedPtr(const WeakPtr<T>& other);
+    template <class Y>
+    explicit SharedPtr(const WeakPtr<Y>& other) {
+        if (other.UseCount() == 0) {
+            BadWeakPtr b;
+            throw b;
+        }
+        object_ = other.Get();
+        block_ = other.GetBlock();
+        block_->IncCounter();
+    };
+
+    explicit SharedPtr(const WeakPtr<T>& other) {
+        if (other.UseCount() == 0) {
+            BadWeakPtr b;
+            throw b;
+        }
+        object_ = other.Get();
+        block_ = other.GetBlock();
+        block_->IncCounter();
+    };
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // `operator=`-s
 
+    // The new reference is taken before the old one is dropped, so self-assignment is safe.
     SharedPtr& operator=(const SharedPtr& other) {
-        if (Get() == nullptr) {
-            object_ = other.object_;
-            block_ = other.block_;
-        } else {
-            object_ = other.object_;
-            block_->DecCounter();
-            block_ = other.block_;
+        if (other.block_ != nullptr) {
+            other.block_->IncCounter();
         }
-        if (Get() != nullptr) {
-            block_->IncCounter();
+        if (block_ != nullptr) {
+            block_->DecCounter();
         }
+        object_ = other.object_;
+        block_ = other.block_;
         return *this;
     };
 
     template <class Y>
     SharedPtr& operator=(const SharedPtr<Y>& other) {
-        if (Get() == nullptr) {
-            object_ = other.Get();
-            block_ = other.GetBlock();
-        } else {
-            object_ = other.Get();
-            block_->DecCounter();
-            block_ = other.GetBlock();
-        }
-        if (Get() != nullptr) {
-            block_->IncCounter();
+        if (other.GetBlock() != nullptr) {
+            other.GetBlock()->IncCounter();
         }
-        return *this;
-    };
-
-    SharedPtr& operator=(SharedPtr&& other) {
-        if (Get() != nullptr) {
+        if (block_ != nullptr) {
             block_->DecCounter();
         }
         object_ = other.Get();
         block_ = other.GetBlock();
-        if (object_ != nullptr) {
-            block_->IncCounter();
-        }
-        other.Reset();
+        return *this;
+    };
+
+    // The old reference is released by the temporary; self-move leaves the pointer as it was
+    SharedPtr& operator=(SharedPtr&& other) noexcept {
+        SharedPtr(std::move(other)).Swap(*this);
         return *this;
     };
 
     template <class Y>
-    SharedPtr& operator=(SharedPtr<Y>&& other) {
-        if (Get() != nullptr) {
-            block_->DecCounter();
-        }
-        object_ = other.Get();
-        block_ = other.GetBlock();
-        if (object_ != nullptr) {
-            block_->IncCounter();
-        }
-        other.Reset();
+    SharedPtr& operator=(SharedPtr<Y>&& other) noexcept {
+        SharedPtr(std::move(other)).Swap(*this);
         return *this;
     };
 
@@ -241,7 +263,7 @@ public:
     // Destructor
 
     ~SharedPtr() {
-        if (object_ != nullptr || block_ != nullptr) {
+        if (block_ != nullptr) {
             block_->DecCounter();
         }
     };
@@ -250,7 +272,7 @@ public:
     // Modifiers
 
     void Reset() noexcept {
-        if (object_ != nullptr) {
+        if (block_ != nullptr) {
             object_ = nullptr;
             block_->DecCounter();
             block_ = nullptr;
@@ -259,7 +281,7 @@ public:
 
     template <class Y>
     void Reset(Y* ptr) {
-        if (object_ != nullptr) {
+        if (block_ != nullptr) {
             block_->DecCounter();
         }
         object_ = ptr;
@@ -267,7 +289,7 @@ public:
         block_ = block;
     };
 
-    void Swap(SharedPtr& other) {
+    void Swap(SharedPtr& other) noexcept {
         std::swap(object_, other.object_);
         std::swap(block_, other.block_);
     };
@@ -275,13 +297,10 @@ public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Observers
 
+    // The stored pointer is always valid (MakeShared points it into its block),
+    // so observers never touch the control block.
     T* Get() const {
-        if (block_ != nullptr && object_ == nullptr) {
-            AllocatedByOurselves<T>* block = dynamic_cast<AllocatedByOurselves<T>*>(block_);
-            return block->GetObject();
-        } else {
-            return object_;
-        }
+        return object_;
     };
 
     BlockBase* GetBlock() const {
@@ -289,25 +308,15 @@ public:
     }
 
     T& operator*() const {
-        if (block_ != nullptr && object_ == nullptr) {
-            AllocatedByOurselves<T>* block = dynamic_cast<AllocatedByOurselves<T>*>(block_);
-            return *(block->GetObject());
-        } else {
-            return *object_;
-        }
+        return *object_;
     };
 
     T* operator->() const {
-        if (block_ != nullptr && object_ == nullptr) {
-            AllocatedByOurselves<T>* block = dynamic_cast<AllocatedByOurselves<T>*>(block_);
-            return block->GetObject();
-        } else {
-            return object_;
-        }
+        return object_;
     };
 
     size_t UseCount() const {
-        if (object_ == nullptr) {
+        if (block_ == nullptr) {
             return 0;
         } else {
             return block_->GetCount();
@@ -319,6 +328,9 @@ public:
     };
 
 private:
+    template <typename Y>
+    friend class SharedPtr;
+
     T* object_;
     BlockBase* block_;
 };
@@ -345,5 +357,3 @@ public:
     WeakPtr<T> WeakFromThis() noexcept;
     WeakPtr<const T> WeakFromThis() const noexcept;
 };
-
-
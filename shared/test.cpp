@@ -5,6 +5,8 @@
 #include "allocations_checker.h"
 
 #include <memory>
+#include <type_traits>
+#include <utility>
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -68,6 +70,37 @@ TEST_CASE("Copy/move") {
     REQUIRE(*end == "delete");
 }
 
+static_assert(std::is_nothrow_move_constructible_v<SharedPtr<int>>);
+static_assert(std::is_nothrow_move_assignable_v<SharedPtr<int>>);
+static_assert(std::is_nothrow_constructible_v<SharedPtr<const int>, SharedPtr<int>&&>);
+static_assert(std::is_nothrow_assignable_v<SharedPtr<const int>&, SharedPtr<int>&&>);
+
+TEST_CASE("Moves steal the reference") {
+    auto a = MakeShared<int>(1);
+    SharedPtr<int> b(std::move(a));
+    REQUIRE(a.Get() == nullptr);
+    REQUIRE(a.UseCount() == 0);
+    REQUIRE(b.UseCount() == 1);
+
+    SharedPtr<const int> c(std::move(b));
+    REQUIRE(b.Get() == nullptr);
+    REQUIRE(c.UseCount() == 1);
+
+    auto d = MakeShared<int>(2);
+    a = std::move(d);
+    REQUIRE(d.Get() == nullptr);
+    REQUIRE(a.UseCount() == 1);
+    c = std::move(a);
+    REQUIRE(a.Get() == nullptr);
+    REQUIRE(*c == 2);
+    REQUIRE(c.UseCount() == 1);
+
+    auto& self = c;
+    c = std::move(self);
+    REQUIRE(*c == 2);
+    REQUIRE(c.UseCount() == 1);
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 struct ModifiersB {
@@ -408,6 +441,27 @@ public:
 
 bool Derived::i_was_deleted = false;
 
+struct ConversionLeft {
+    virtual ~ConversionLeft() = default;
+
+    int left = 1;
+};
+
+struct ConversionRight {
+    virtual ~ConversionRight() = default;
+    virtual int Value() const {
+        return right;
+    }
+
+    int right = 2;
+};
+
+struct ConversionBoth : ConversionLeft, ConversionRight {
+    int Value() const override {
+        return 3;
+    }
+};
+
 TEST_CASE("Type conversions") {
     SECTION("Destruction") {
         Derived::i_was_deleted = false;
@@ -415,6 +469,18 @@ TEST_CASE("Type conversions") {
         REQUIRE(Derived::i_was_deleted);
     }
 
+    SECTION("Base from MakeShared of derived") {
+        auto both = MakeShared<ConversionBoth>();
+        SharedPtr<ConversionRight> right = both;
+        SharedPtr<ConversionLeft> left = std::move(both);
+
+        REQUIRE(right.Get() == static_cast<ConversionRight*>(static_cast<ConversionBoth*>(left.Get())));
+        REQUIRE(right->Value() == 3);
+        REQUIRE((*right).right == 2);
+        REQUIRE(left->left == 1);
+        REQUIRE(right.UseCount() == 2);
+    }
+
     SECTION("Constness") {
         SharedPtr<int> s1(new int(42));
         SharedPtr<const int> s2 = s1;
@@ -414,6 +414,28 @@ TEST_CASE("Array specialization") {
     }
 }
 
+TEST_CASE("MakeUniqueForOverwrite") {
+    SECTION("Single object") {
+        auto u = MakeUniqueForOverwrite<MyInt>();
+        REQUIRE(MyInt::AliveCount() == 1);
+        u.Reset();
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Array") {
+        auto u = MakeUniqueForOverwrite<MyInt[]>(10);
+        REQUIRE(MyInt::AliveCount() == 10);
+        u.Reset();
+        REQUIRE(MyInt::AliveCount() == 0);
+    }
+
+    SECTION("Trivial buffer") {
+        UniquePtr<char[]> buffer = MakeUniqueForOverwrite<char[]>(4096);
+        buffer[4095] = 'x';
+        REQUIRE(buffer[4095] == 'x');
+    }
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 template <typename T>
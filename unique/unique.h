@@ -3,6 +3,10 @@
 #include "compressed_pair.h"
 
 #include <cstddef>  // std::nullptr_t
+#include <type_traits>
+
+// Build with SMART_PTR_INSTRUMENTATION to count adopted and deleted objects per pointee type
+#include <common/refcount_stats.h>
 
 template <class T>
 struct Slug {
@@ -43,11 +47,13 @@ public:
 
     explicit UniquePtr(T* ptr = nullptr) {
         my_ptr_.GetFirst() = std::move(ptr);
+        RecordAdopted();
     };
 
     UniquePtr(T* ptr, Deleter deleter) noexcept {
         my_ptr_.GetFirst() = ptr;
         my_ptr_.GetSecond() = std::move(deleter);
+        RecordAdopted();
     };
 
     template <class T1, class D1>
@@ -80,6 +86,9 @@ public:
     // Destructor
 
     ~UniquePtr() {
+        if (my_ptr_.GetFirst() != nullptr) {
+            SMART_PTR_RECORD(T, kDestruction);
+        }
         my_ptr_.GetSecond()(my_ptr_.GetFirst());
     };
 
@@ -95,7 +104,9 @@ public:
     void Reset(T* ptr = nullptr) noexcept {
         T* tmp_ptr = my_ptr_.GetFirst();
         my_ptr_.GetFirst() = ptr;
+        RecordAdopted();
         if (tmp_ptr != nullptr) {
+            SMART_PTR_RECORD(T, kDestruction);
             delete tmp_ptr;
         }
     };
@@ -135,6 +146,17 @@ public:
         return my_ptr_.GetFirst();
     };
 
+private:
+    template <typename T1, typename D1>
+    friend class UniquePtr;
+
+    // Objects a UniquePtr took ownership of count as allocations
+    void RecordAdopted() noexcept {
+        if (my_ptr_.GetFirst() != nullptr) {
+            SMART_PTR_RECORD(T, kAllocation);
+        }
+    }
+
     CompressedPair<T*, Deleter> my_ptr_;
 };
 
@@ -147,11 +169,13 @@ public:
 
     explicit UniquePtr(T* ptr = nullptr) {
         my_ptr_.GetFirst() = std::move(ptr);
+        RecordAdopted();
     };
 
     UniquePtr(T* ptr, Deleter deleter) noexcept {
         my_ptr_.GetFirst() = ptr;
         my_ptr_.GetSecond() = std::move(deleter);
+        RecordAdopted();
     };
 
     template <class T1, class D1>
@@ -180,6 +204,9 @@ public:
     // Destructor
 
     ~UniquePtr() {
+        if (my_ptr_.GetFirst() != nullptr) {
+            SMART_PTR_RECORD(T, kDestruction);
+        }
         my_ptr_.GetSecond()(my_ptr_.GetFirst());
     };
 
@@ -195,7 +222,9 @@ public:
     void Reset(T* ptr = nullptr) noexcept {
         T* tmp_ptr = my_ptr_.GetFirst();
         my_ptr_.GetFirst() = ptr;
+        RecordAdopted();
         if (tmp_ptr != nullptr) {
+            SMART_PTR_RECORD(T, kDestruction);
             delete[] tmp_ptr;
         }
     };
@@ -238,6 +267,26 @@ public:
     };
 
 private:
+    // Objects a UniquePtr took ownership of count as allocations
+    void RecordAdopted() noexcept {
+        if (my_ptr_.GetFirst() != nullptr) {
+            SMART_PTR_RECORD(T, kAllocation);
+        }
+    }
+
     CompressedPair<T*, Deleter> my_ptr_;
 };
 
+// Default-initialize the object instead of value-initializing it, so a trivially constructible
+// payload is not zeroed first
+template <typename T>
+requires(!std::is_array_v<T>)
+UniquePtr<T> MakeUniqueForOverwrite() {
+    return UniquePtr<T>(new T);
+};
+
+template <typename T>
+requires std::is_unbounded_array_v<T>
+UniquePtr<T> MakeUniqueForOverwrite(size_t size) {
+    return UniquePtr<T>(new std::remove_extent_t<T>[size]);
+};
@@ -0,0 +1,186 @@
+#pragma once
+
+#include "shared.h"
+#include "weak.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+
+// Lock-free atomic SharedPtr/WeakPtr based on split reference counting.
+// The atomic word packs a pointer to an immutable node that holds the published pointer with a
+// 16-bit count of readers that are copying out of that node right now ("local" references).
+// A reader bumps the local count, copies the pointer and gives the local reference back.
+// A writer that swaps a node out moves its local count into the node's own counter, so
+// readers that are still copying keep the node alive and drop it themselves.
+// Needs user-space addresses to fit in 48 bits, as they do on x86-64 and AArch64 Linux,
+// and at most 65535 readers inside one Load at a time.
+template <typename Ptr>
+class AtomicPtrBase {
+public:
+    AtomicPtrBase() = default;
+
+    AtomicPtrBase(Ptr desired) {
+        word_.store(Pack(MakeNode(std::move(desired))), std::memory_order_relaxed);
+    }
+
+    AtomicPtrBase(const AtomicPtrBase&) = delete;
+    AtomicPtrBase& operator=(const AtomicPtrBase&) = delete;
+
+    ~AtomicPtrBase() {
+        uintptr_t word = word_.load(std::memory_order_relaxed);
+        Retire(Unpack(word), word >> kLocalShift);
+    }
+
+    Ptr Load() const {
+        Node* node = Reserve();
+        Ptr result;
+        if (node != nullptr) {
+            result = node->value;
+        }
+        Unreserve(node);
+        return result;
+    }
+
+    void Store(Ptr desired) {
+        uintptr_t old = word_.exchange(Pack(MakeNode(std::move(desired))), std::memory_order_acq_rel);
+        Retire(Unpack(old), old >> kLocalShift);
+    }
+
+    Ptr Exchange(Ptr desired) {
+        uintptr_t old = word_.exchange(Pack(MakeNode(std::move(desired))), std::memory_order_acq_rel);
+        Node* node = Unpack(old);
+        Ptr previous;
+        if (node != nullptr) {
+            previous = node->value;
+        }
+        Retire(node, old >> kLocalShift);
+        return previous;
+    }
+
+    // Replaces the pointer with `desired` if it still shares the object and the control block
+    // of `expected`; otherwise loads the current pointer into `expected`. Never fails spuriously.
+    bool CompareExchange(Ptr& expected, Ptr desired) {
+        Node* fresh = nullptr;
+        while (true) {
+            Node* node = Reserve();
+            if (!Equivalent(node, expected)) {
+                expected = node != nullptr ? node->value : Ptr();
+                Unreserve(node);
+                delete fresh;
+                return false;
+            }
+            if (fresh == nullptr) {
+                fresh = MakeNode(desired);
+            }
+            uintptr_t word = word_.load(std::memory_order_relaxed);
+            while (Unpack(word) == node) {
+                if (word_.compare_exchange_weak(word, Pack(fresh), std::memory_order_acq_rel,
+                                                std::memory_order_relaxed)) {
+                    // Our own reservation was in the local count too
+                    Retire(node, word >> kLocalShift);
+                    Release(node);
+                    return true;
+                }
+            }
+            // Someone else swapped the node out and turned our reservation into a reference
+            Release(node);
+        }
+    }
+
+    bool IsLockFree() const {
+        return word_.is_lock_free();
+    }
+
+private:
+    struct Node {
+        explicit Node(Ptr published) : value(std::move(published)) {
+        }
+
+        std::atomic<int64_t> refs = 1;
+        const Ptr value;
+    };
+
+    static_assert(sizeof(uintptr_t) == 8, "split reference counts need 64-bit pointers");
+    static_assert(std::atomic<uintptr_t>::is_always_lock_free);
+
+    static constexpr int kLocalShift = 48;
+    static constexpr uintptr_t kOneLocal = uintptr_t{1} << kLocalShift;
+    static constexpr uintptr_t kNodeMask = kOneLocal - 1;
+
+    static Node* MakeNode(Ptr value) {
+        if (value.Get() == nullptr && value.GetBlock() == nullptr) {
+            return nullptr;
+        }
+        return new Node(std::move(value));
+    }
+
+    static uintptr_t Pack(Node* node) {
+        uintptr_t word = reinterpret_cast<uintptr_t>(node);
+        assert((word & ~kNodeMask) == 0);
+        return word;
+    }
+
+    static Node* Unpack(uintptr_t word) {
+        return reinterpret_cast<Node*>(word & kNodeMask);
+    }
+
+    static bool Equivalent(Node* node, const Ptr& expected) {
+        if (node == nullptr) {
+            return expected.Get() == nullptr && expected.GetBlock() == nullptr;
+        }
+        return node->value.Get() == expected.Get() && node->value.GetBlock() == expected.GetBlock();
+    }
+
+    // Takes a local reference to the current node
+    Node* Reserve() const {
+        return Unpack(word_.fetch_add(kOneLocal, std::memory_order_acquire));
+    }
+
+    // Gives a local reference back, or drops the reference a writer turned it into
+    void Unreserve(Node* node) const {
+        uintptr_t word = word_.load(std::memory_order_relaxed);
+        while (Unpack(word) == node) {
+            if (word_.compare_exchange_weak(word, word - kOneLocal, std::memory_order_release,
+                                            std::memory_order_relaxed)) {
+                return;
+            }
+        }
+        Release(node);
+    }
+
+    // Called on a node that was just swapped out: readers still holding `local` references
+    // get a real reference each, and the reference of the atomic itself goes away.
+    static void Retire(Node* node, uintptr_t local) {
+        if (node == nullptr) {
+            return;
+        }
+        int64_t delta = static_cast<int64_t>(local) - 1;
+        if (node->refs.fetch_add(delta, std::memory_order_acq_rel) + delta == 0) {
+            delete node;
+        }
+    }
+
+    static void Release(Node* node) {
+        if (node != nullptr && node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete node;
+        }
+    }
+
+    mutable std::atomic<uintptr_t> word_ = 0;
+};
+
+// https://en.cppreference.com/w/cpp/memory/shared_ptr/atomic2
+template <typename T>
+class AtomicSharedPtr : public AtomicPtrBase<SharedPtr<T>> {
+public:
+    using AtomicPtrBase<SharedPtr<T>>::AtomicPtrBase;
+};
+
+// https://en.cppreference.com/w/cpp/memory/weak_ptr/atomic2
+template <typename T>
+class AtomicWeakPtr : public AtomicPtrBase<WeakPtr<T>> {
+public:
+    using AtomicPtrBase<WeakPtr<T>>::AtomicPtrBase;
+};
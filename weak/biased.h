@@ -0,0 +1,261 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Biased reference counting (Choi, Shull, Torrellas, PACT'18).
+// The thread that creates a block owns it and counts its own references in a plain counter;
+// every other thread uses a separate atomic counter. The two are merged when the owner drops
+// its last reference. If another thread's release would take the atomic counter below zero
+// while the owner still has references, the block is queued for the owner to merge later.
+
+class BiasedStrongCounter;
+
+// Per-thread state: the queue of blocks waiting for this thread to merge them.
+// States are never freed, so blocks may outlive their owner. When a thread exits its queue is
+// closed, and whoever would have queued a block merges it on the owner's behalf.
+class BiasedThreadState {
+public:
+    static BiasedThreadState* Current() {
+        if (current == nullptr) {
+            Create();
+        }
+        return current;
+    }
+
+    static BiasedThreadState* CurrentOrNull() {
+        return current;
+    }
+
+    bool HasQueued() const {
+        BiasedStrongCounter* head = queue_.load(std::memory_order_relaxed);
+        return head != nullptr && head != Closed();
+    }
+
+    // Returns false if the owner thread has already exited
+    bool Push(BiasedStrongCounter* counter);
+
+    // Merges every queued block; run by the owner thread only
+    void Drain();
+
+private:
+    struct ExitGuard {
+        ~ExitGuard() {
+            if (state != nullptr) {
+                state->Close();
+            }
+        }
+
+        BiasedThreadState* state = nullptr;
+    };
+
+    static BiasedStrongCounter* Closed() {
+        return reinterpret_cast<BiasedStrongCounter*>(uintptr_t{1});
+    }
+
+    static void Create() {
+        static thread_local ExitGuard exit_guard;
+        current = new BiasedThreadState;
+        exit_guard.state = current;
+        current->next_state_ = all_states.load(std::memory_order_relaxed);
+        while (!all_states.compare_exchange_weak(current->next_state_, current,
+                                                 std::memory_order_release,
+                                                 std::memory_order_relaxed)) {
+        }
+    }
+
+    void Close();
+    static void MergeList(BiasedStrongCounter* counter);
+
+    std::atomic<BiasedStrongCounter*> queue_ = nullptr;
+    BiasedThreadState* next_state_ = nullptr;
+
+    static inline constinit thread_local BiasedThreadState* current = nullptr;
+    // Keeps every state reachable, they live as long as the process
+    static inline std::atomic<BiasedThreadState*> all_states = nullptr;
+};
+
+// Strong counter for biased mode, used as the base of BlockBase.
+// `shared_` packs the atomic count (which may go negative) with two flags in the low bits.
+class BiasedStrongCounter {
+public:
+    BiasedStrongCounter() : owner_(BiasedThreadState::Current()) {
+    }
+
+    void IncRef() {
+        if (IsOwner()) {
+            biased_.store(biased_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        } else {
+            shared_.fetch_add(kOne, std::memory_order_relaxed);
+        }
+    }
+
+    // Takes a reference unless the object is already gone. Before the merge the owner still
+    // holds references, so the object is alive; after it `shared_` holds the whole count, and
+    // the compare-and-swap fails if the merge happens in between.
+    bool IncRefIfNonZero() {
+        if (IsOwner()) {
+            biased_.store(biased_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return true;
+        }
+        int64_t old = shared_.load(std::memory_order_relaxed);
+        do {
+            if ((old & kMerged) && (old >> kFlagBits) <= 0) {
+                return false;
+            }
+        } while (!shared_.compare_exchange_weak(old, old + kOne, std::memory_order_relaxed));
+        return true;
+    }
+
+    // Returns true when the last reference is gone and the object has to be destroyed
+    bool DecRef() {
+        if (IsOwner()) {
+            uint32_t biased = biased_.load(std::memory_order_relaxed) - 1;
+            biased_.store(biased, std::memory_order_relaxed);
+            if (biased == 0) {
+                // From now on every thread, the owner included, uses `shared_`
+                if (shared_.fetch_add(kMerged, std::memory_order_acq_rel) == 0) {
+                    return true;
+                }
+            }
+            if (owner_->HasQueued()) {
+                owner_->Drain();
+            }
+            return false;
+        }
+
+        return DecShared(1);
+    }
+
+    // `n` references at once: one update of either counter
+    void IncRef(uint32_t n) {
+        if (IsOwner()) {
+            biased_.store(biased_.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+        } else {
+            shared_.fetch_add(int64_t{n} * kOne, std::memory_order_relaxed);
+        }
+    }
+
+    bool DecRef(uint32_t n) {
+        if (!IsOwner()) {
+            return DecShared(n);
+        }
+        uint32_t biased = biased_.load(std::memory_order_relaxed);
+        if (biased > n) {
+            biased_.store(biased - n, std::memory_order_relaxed);
+            if (owner_->HasQueued()) {
+                owner_->Drain();
+            }
+            return false;
+        }
+        // The owner's own count runs out on the way: one at a time, so that it merges
+        for (uint32_t i = 0; i + 1 < n; ++i) {
+            DecRef();
+        }
+        return DecRef();
+    }
+
+    size_t RefCount() const {
+        int64_t count = biased_.load(std::memory_order_relaxed) +
+                        (shared_.load(std::memory_order_relaxed) >> kFlagBits);
+        return count > 0 ? static_cast<size_t>(count) : 0;
+    }
+
+protected:
+    // Called when a merge outside of DecRef finds that the last reference is gone
+    virtual void ReleaseStrong() = 0;
+
+    ~BiasedStrongCounter() = default;
+
+private:
+    friend class BiasedThreadState;
+
+    static constexpr int64_t kMerged = 1;
+    static constexpr int64_t kQueued = 2;
+    static constexpr int kFlagBits = 2;
+    static constexpr int64_t kOne = int64_t{1} << kFlagBits;
+
+    // The owner keeps using `biased_` until it drops to zero, which is exactly when it is merged
+    bool IsOwner() const {
+        return owner_ == BiasedThreadState::CurrentOrNull() &&
+               biased_.load(std::memory_order_relaxed) > 0;
+    }
+
+    // Release of `n` references by a thread other than the owner
+    bool DecShared(uint32_t n) {
+        int64_t old = shared_.load(std::memory_order_relaxed);
+        int64_t now;
+        do {
+            now = old - int64_t{n} * kOne;
+            if ((now >> kFlagBits) < 0) {
+                now |= kQueued;
+            }
+        } while (!shared_.compare_exchange_weak(old, now, std::memory_order_release,
+                                                std::memory_order_relaxed));
+        if (now == kMerged) {
+            shared_.load(std::memory_order_acquire);
+            return true;
+        }
+        if ((now & kQueued) && !(old & kQueued) && !owner_->Push(this)) {
+            return Merge();
+        }
+        return false;
+    }
+
+    // Moves the biased count into `shared_` and clears the queued flag.
+    // Run by the owner, or by the thread that queued the block once the owner has exited.
+    bool Merge() {
+        uint32_t biased = biased_.load(std::memory_order_relaxed);
+        biased_.store(0, std::memory_order_relaxed);
+        int64_t delta = int64_t{biased} * kOne - kQueued + (biased > 0 ? kMerged : 0);
+        return shared_.fetch_add(delta, std::memory_order_acq_rel) + delta == kMerged;
+    }
+
+    BiasedThreadState* const owner_;
+    std::atomic<int64_t> shared_ = 0;
+    BiasedStrongCounter* next_queued_ = nullptr;
+    // Written only by the owner; atomic so that other threads may read it for RefCount()
+    std::atomic<uint32_t> biased_ = 1;
+};
+
+inline bool BiasedThreadState::Push(BiasedStrongCounter* counter) {
+    BiasedStrongCounter* head = queue_.load(std::memory_order_acquire);
+    do {
+        if (head == Closed()) {
+            return false;
+        }
+        counter->next_queued_ = head;
+    } while (!queue_.compare_exchange_weak(head, counter, std::memory_order_release,
+                                           std::memory_order_acquire));
+    return true;
+}
+
+inline void BiasedThreadState::Drain() {
+    MergeList(queue_.exchange(nullptr, std::memory_order_acquire));
+}
+
+inline void BiasedThreadState::Close() {
+    MergeList(queue_.exchange(Closed(), std::memory_order_acq_rel));
+}
+
+inline void BiasedThreadState::MergeList(BiasedStrongCounter* counter) {
+    while (counter != nullptr) {
+        // Merging may free the block, so step past it first
+        BiasedStrongCounter* next = counter->next_queued_;
+        if (counter->Merge()) {
+            counter->ReleaseStrong();
+        }
+        counter = next;
+    }
+}
+
+// Merges the blocks other threads have queued for the calling thread.
+// Owners also do this on their own releases and on exit; call it at quiescent points
+// (e.g. when an event loop goes idle) to release such objects sooner.
+inline void MergeBiasedCounters() {
+    BiasedThreadState* state = BiasedThreadState::CurrentOrNull();
+    if (state != nullptr && state->HasQueued()) {
+        state->Drain();
+    }
+}
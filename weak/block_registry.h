@@ -0,0 +1,206 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <source_location>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Registry of live control blocks for leak hunting, compiled in with SHARED_PTR_BLOCK_REGISTRY.
+// A block links itself into one of kShards lists (picked by its address) when it is
+// constructed and unlinks itself when it is freed, so threads creating and freeing blocks
+// rarely wait for each other. TakeLiveBlocks() walks the shards one at a time.
+//
+// The counters of LocalCounting blocks are plain and only their thread may read them, so a
+// snapshot lists only the LocalCounting blocks of the thread that takes it; take one on every
+// thread that uses LocalSharedPtr to see all of them.
+//
+// A block's creation site is the innermost BlockSite alive on the creating thread. Default
+// arguments cannot follow the argument pack of MakeShared, so the site cannot be captured
+// inside it; put a BlockSite where the interesting objects are made instead:
+//     BlockSite site;  // blocks made below report this line
+//     auto session = MakeShared<Session>(...);
+
+class BlockSite {
+public:
+    explicit BlockSite(std::source_location site = std::source_location::current())
+        : site_(site), outer_(current) {
+        current = this;
+    }
+
+    BlockSite(const BlockSite&) = delete;
+    BlockSite& operator=(const BlockSite&) = delete;
+
+    ~BlockSite() {
+        current = outer_;
+    }
+
+    // Empty when there is no BlockSite on this thread
+    static std::source_location Current() {
+        return current == nullptr ? std::source_location() : current->site_;
+    }
+
+private:
+    std::source_location site_;
+    const BlockSite* outer_;
+
+    static inline constinit thread_local const BlockSite* current = nullptr;
+};
+
+// One block at the time of the snapshot
+struct LiveBlock {
+    std::string type;
+    size_t strong = 0;
+    size_t weak = 0;
+    // The whole allocation: block, and the object when it is stored inline
+    size_t bytes = 0;
+    std::source_location site;
+
+    // The object is gone but WeakPtr-s still hold on to the block
+    bool WeakOnly() const {
+        return strong == 0;
+    }
+};
+
+// Blocks of one type created at one site
+struct BlockPopulation {
+    int64_t blocks = 0;
+    int64_t bytes = 0;
+    int64_t weak_only = 0;
+
+    bool operator==(const BlockPopulation&) const = default;
+};
+
+// "type @ file:line" -> population; ordered, so that printed snapshots diff line by line
+using BlockPopulations = std::map<std::string, BlockPopulation>;
+
+// `Block` is a BasicBlock; it provides GetCount(), GetCountWeak() and CountingPolicy
+template <class Block>
+class BlockRegistry {
+public:
+    static constexpr size_t kShards = 16;
+
+    // Embedded in every block
+    struct Node {
+        Node* prev = nullptr;
+        Node* next = nullptr;
+        const Block* block = nullptr;
+        std::string_view type;
+        size_t bytes = 0;
+        std::source_location site;
+        std::thread::id owner;
+    };
+
+    static void Register(Node& node, const Block* block, std::string_view type, size_t bytes) {
+        node.block = block;
+        node.type = type;
+        node.bytes = bytes;
+        node.site = BlockSite::Current();
+        node.owner = std::this_thread::get_id();
+        Shard& shard = ShardOf(block);
+        std::lock_guard lock(shard.mutex);
+        node.prev = &shard.head;
+        node.next = shard.head.next;
+        if (node.next != nullptr) {
+            node.next->prev = &node;
+        }
+        shard.head.next = &node;
+    }
+
+    static void Unregister(Node& node) {
+        Shard& shard = ShardOf(node.block);
+        std::lock_guard lock(shard.mutex);
+        node.prev->next = node.next;
+        if (node.next != nullptr) {
+            node.next->prev = node.prev;
+        }
+    }
+
+    static std::vector<LiveBlock> Snapshot() {
+        std::vector<LiveBlock> blocks;
+        for (Shard& shard : Shards()) {
+            // A block unregisters under this lock, so it cannot be freed while it is read
+            std::lock_guard lock(shard.mutex);
+            for (const Node* node = shard.head.next; node != nullptr; node = node->next) {
+                if constexpr (!Block::CountingPolicy::kAtomic) {
+                    if (node->owner != std::this_thread::get_id()) {
+                        continue;
+                    }
+                }
+                blocks.push_back({std::string(node->type), node->block->GetCount(),
+                                  node->block->GetCountWeak(), node->bytes, node->site});
+            }
+        }
+        return blocks;
+    }
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        Node head;
+    };
+
+    static Shard& ShardOf(const Block* block) {
+        // Blocks are at least 16 bytes apart
+        return Shards()[std::hash<const void*>()(block) / 16 % kShards];
+    }
+
+    // Leaked, so that blocks freed by static destructors still find their shard
+    static std::array<Shard, kShards>& Shards() {
+        static auto* shards = new std::array<Shard, kShards>;
+        return *shards;
+    }
+};
+
+inline std::string SiteName(const std::source_location& site) {
+    if (site.line() == 0) {
+        return "?";
+    }
+    return std::string(site.file_name()) + ":" + std::to_string(site.line());
+}
+
+inline BlockPopulations Populations(const std::vector<LiveBlock>& blocks) {
+    BlockPopulations populations;
+    for (const LiveBlock& block : blocks) {
+        BlockPopulation& population = populations[block.type + " @ " + SiteName(block.site)];
+        ++population.blocks;
+        population.bytes += block.bytes;
+        population.weak_only += block.WeakOnly() ? 1 : 0;
+    }
+    return populations;
+}
+
+// Growth between two snapshots; populations that did not change are left out
+inline BlockPopulations operator-(const BlockPopulations& after, const BlockPopulations& before) {
+    BlockPopulations diff;
+    auto add = [&diff](const std::string& key, const BlockPopulation& population, int64_t sign) {
+        BlockPopulation& delta = diff[key];
+        delta.blocks += sign * population.blocks;
+        delta.bytes += sign * population.bytes;
+        delta.weak_only += sign * population.weak_only;
+    };
+    for (const auto& [key, population] : after) {
+        add(key, population, 1);
+    }
+    for (const auto& [key, population] : before) {
+        add(key, population, -1);
+    }
+    std::erase_if(diff, [](const auto& entry) { return entry.second == BlockPopulation{}; });
+    return diff;
+}
+
+// One line per population: "<blocks> <bytes> <weak-only> <type> @ <site>"
+inline std::ostream& operator<<(std::ostream& out, const BlockPopulations& populations) {
+    for (const auto& [key, population] : populations) {
+        out << population.blocks << ' ' << population.bytes << ' ' << population.weak_only << ' '
+            << key << '\n';
+    }
+    return out;
+}
@@ -0,0 +1,209 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+// Hazard pointers for control blocks, compiled in with SHARED_PTR_HAZARD_POINTERS.
+// A reader publishes the block it is about to read in one of its thread's slots and then
+// checks that the object is still alive; a final release scans every slot after dropping the
+// count and, if the block is published, retires it instead of destroying the object. With a
+// seq_cst fence on both sides, either the reader sees the zero count and backs off, or the
+// releaser sees the hazard and defers, so a reader that got in never touches a dead object.
+// Retired blocks are destroyed by Reclaim(), which the last guard of any thread triggers on
+// its way out when it sees something retired. The releaser checks its block again after
+// retiring it, with a seq_cst fence in between just as the guard has one between clearing its
+// slot and looking at the retired count, so either the guard sees the block retired or the
+// releaser sees it unprotected and reclaims it itself; nothing waits for an explicit
+// Reclaim(). Retired blocks are linked through the blocks themselves, so retiring never
+// allocates.
+//
+// HazardGuard in weak.h is the interface; this is the bookkeeping behind it. Every thread that
+// ever protects a block owns a record of kSlots slots, linked into a list that only grows;
+// records of exited threads are reused. Scanning costs one load per slot of every record, paid
+// by final releases only, and only once some thread has taken a guard.
+
+// `Block` is BlockBase; it provides GetCount(), DestroyRetired() and retired_next_
+template <class Block>
+class HazardPointers {
+public:
+    // Guards one thread can hold at once
+    static constexpr size_t kSlots = 4;
+
+    using Slot = std::atomic<const Block*>;
+
+    // A free slot of the calling thread, null if all are taken or there is no memory for the
+    // thread's record
+    static Slot* Acquire() noexcept {
+        Owner& owner = owner_of_thread;
+        if (owner.record == nullptr) {
+            owner.record = ClaimRecord();
+            if (owner.record == nullptr) {
+                return nullptr;
+            }
+        }
+        for (size_t i = 0; i < kSlots; ++i) {
+            if ((owner.used & (1u << i)) == 0) {
+                owner.used |= 1u << i;
+                return &owner.record->slots[i];
+            }
+        }
+        return nullptr;
+    }
+
+    // Publishes `block`; the caller then checks that its object is still alive
+    static void Protect(Slot* slot, const Block* block) {
+        slot->store(block, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    static void Release(Slot* slot) {
+        slot->store(nullptr, std::memory_order_release);
+        Owner& owner = owner_of_thread;
+        owner.used &= ~(1u << (slot - owner.record->slots));
+        if (owner.used == 0) {
+            // Pairs with the second fence in RetireIfProtected
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (State().retired_count.load(std::memory_order_relaxed) != 0) {
+                Reclaim();
+            }
+        }
+    }
+
+    // Called by the final release after the count dropped to zero; false if the caller is to
+    // destroy the object
+    static bool RetireIfProtected(Block* block) {
+        Shared& state = State();
+        // Nobody has taken a guard yet. The first record is published with a seq_cst store
+        // before its slots are used, and the decrement before this is seq_cst too, so a reader
+        // that comes later sees the count at zero after its fence.
+        if (state.records.load(std::memory_order_seq_cst) == nullptr) {
+            return false;
+        }
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!IsProtected(block)) {
+            return false;
+        }
+        {
+            std::lock_guard lock(state.mutex);
+            block->retired_next_ = state.retired;
+            state.retired = block;
+            state.retired_count.store(state.retired_count.load(std::memory_order_relaxed) + 1,
+                                      std::memory_order_relaxed);
+        }
+        // A guard cleared before this fence may have missed the block, so look again
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!IsProtected(block)) {
+            Reclaim();
+        }
+        return true;
+    }
+
+    // Destroys the retired objects that nobody protects any more; returns their number
+    static size_t Reclaim() {
+        Shared& state = State();
+        Block* free = nullptr;
+        size_t count = 0;
+        {
+            std::lock_guard lock(state.mutex);
+            Block** link = &state.retired;
+            while (*link != nullptr) {
+                Block* block = *link;
+                if (IsProtected(block)) {
+                    link = &block->retired_next_;
+                    continue;
+                }
+                *link = block->retired_next_;
+                block->retired_next_ = free;
+                free = block;
+                ++count;
+            }
+            state.retired_count.store(state.retired_count.load(std::memory_order_relaxed) - count,
+                                      std::memory_order_relaxed);
+        }
+        // Outside the lock: destructors may release more objects
+        while (free != nullptr) {
+            Block* next = free->retired_next_;
+            free->DestroyRetired();
+            free = next;
+        }
+        return count;
+    }
+
+    // Released objects waiting for their readers to leave
+    static size_t Retired() {
+        return State().retired_count.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct alignas(64) Record {
+        Slot slots[kSlots] = {};
+        std::atomic<bool> active = true;
+        Record* next = nullptr;
+    };
+
+    struct Owner {
+        ~Owner() {
+            if (record != nullptr) {
+                record->active.store(false, std::memory_order_release);
+            }
+        }
+
+        Record* record = nullptr;
+        uint32_t used = 0;
+    };
+
+    struct Shared {
+        std::atomic<Record*> records = nullptr;
+        std::atomic<size_t> retired_count = 0;
+        std::mutex mutex;
+        // Linked through retired_next_
+        Block* retired = nullptr;
+    };
+
+    // Leaked, so that blocks released by static destructors still find it
+    static Shared& State() {
+        static auto* state = new Shared;
+        return *state;
+    }
+
+    // Null if a new record is needed and there is no memory for it
+    static Record* ClaimRecord() noexcept {
+        Shared& state = State();
+        for (Record* record = state.records.load(std::memory_order_acquire); record != nullptr;
+             record = record->next) {
+            bool active = false;
+            if (record->active.load(std::memory_order_relaxed) == false &&
+                record->active.compare_exchange_strong(active, true, std::memory_order_acquire)) {
+                return record;
+            }
+        }
+        auto* record = new (std::nothrow) Record;
+        if (record == nullptr) {
+            return nullptr;
+        }
+        // seq_cst for the sake of the first record, see RetireIfProtected
+        Record* head = state.records.load(std::memory_order_relaxed);
+        do {
+            record->next = head;
+        } while (!state.records.compare_exchange_weak(head, record, std::memory_order_seq_cst,
+                                                      std::memory_order_relaxed));
+        return record;
+    }
+
+    static bool IsProtected(const Block* block) {
+        for (Record* record = State().records.load(std::memory_order_acquire); record != nullptr;
+             record = record->next) {
+            for (const Slot& slot : record->slots) {
+                if (slot.load(std::memory_order_acquire) == block) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    static inline thread_local Owner owner_of_thread;
+};
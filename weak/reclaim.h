@@ -0,0 +1,260 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+// Deferred destruction of objects whose last SharedPtr goes away, compiled in with
+// SHARED_PTR_DEFERRED_RECLAMATION. A thread opts in with a DeferReleases scope: while one is
+// alive, a final release on that thread does not run the destructor but appends the block to
+// the thread's retire list, which costs a push_back.
+//
+// Reclamation goes by epochs. EpochReclaimer::Advance() moves to the next epoch and destroys
+// every block handed off before it. A thread hands the blocks it retired in earlier epochs
+// off (one mutex) on its first release in a new one, and its whole list when that reaches
+// kBatch blocks and when its outermost DeferReleases scope ends; in between it only takes the
+// lock of its own list, which nobody else contends for but Advance(). Advance() also takes the
+// lists of threads that have retired nothing since before the epoch it ends, so a thread that
+// goes quiet inside its scope does not keep its last blocks alive.
+// Advance() may be called by hand, or periodically by the background thread that Start() runs:
+//     EpochReclaimer<BlockBase>::Start(std::chrono::milliseconds(1));
+//     ...
+//     DeferReleases defer;  // on the request thread
+//
+// A block with no strong references cannot be reached again (WeakPtr::Lock fails as soon as
+// the count is zero), so any delay is safe and epochs only decide when the destruction runs.
+// Destructors run on the thread that calls Advance(), in no particular order. When there is no
+// memory to queue a block, it is destroyed on the spot, as if no scope were active.
+
+// Marks the calling thread's final releases as deferred for its lifetime; nests
+class DeferReleases {
+public:
+    DeferReleases() {
+        ++depth;
+    }
+
+    DeferReleases(const DeferReleases&) = delete;
+    DeferReleases& operator=(const DeferReleases&) = delete;
+
+    // Defined with the reclaimer: the outermost scope hands the retire list off
+    ~DeferReleases();
+
+    static bool Active() {
+        return depth > 0;
+    }
+
+private:
+    static inline constinit thread_local size_t depth = 0;
+};
+
+// `Block` is BlockBase; it provides DestroyRetired(), which destroys the object and releases
+// the block
+template <class Block>
+class EpochReclaimer {
+public:
+    // Retire list length at which a thread hands it off without waiting for an epoch change
+    static constexpr size_t kBatch = 256;
+
+    // Called instead of destroying the object; false if the block could not be queued, in which
+    // case the caller destroys it
+    static bool Retire(Block* block) noexcept {
+        RetireList& list = local;
+        uint64_t epoch = State().epoch.load(std::memory_order_relaxed);
+        std::unique_lock own(list.mutex);
+        if (list.epoch != epoch) {
+            if (!list.blocks.empty()) {
+                own.unlock();
+                Flush();
+                own.lock();
+            }
+            list.epoch = epoch;
+        }
+        try {
+            list.blocks.push_back(block);
+        } catch (const std::bad_alloc&) {
+            return false;
+        }
+        if (list.blocks.size() >= kBatch) {
+            own.unlock();
+            Flush();
+        }
+        return true;
+    }
+
+    // Hands the calling thread's retire list to the reclaimer; without memory for that, the list
+    // is kept for the next try
+    static void Flush() noexcept {
+        RetireList& list = local;
+        {
+            std::lock_guard own(list.mutex);
+            if (list.blocks.empty()) {
+                return;
+            }
+        }
+        Shared& state = State();
+        std::lock_guard lock(state.mutex);
+        std::lock_guard own(list.mutex);
+        list.HandOff(state);
+    }
+
+    // Starts the next epoch and destroys every block handed off so far, and those of threads
+    // that retired nothing in the epoch that ends; returns their number
+    static size_t Advance() {
+        Shared& state = State();
+        std::vector<Block*> blocks;
+        {
+            std::lock_guard lock(state.mutex);
+            uint64_t ended = state.epoch.fetch_add(1, std::memory_order_relaxed);
+            for (RetireList* list : state.lists) {
+                std::lock_guard own(list->mutex);
+                if (list->epoch < ended) {
+                    list->HandOff(state);
+                }
+            }
+            blocks.swap(state.pending);
+        }
+        // Outside the lock: a destructor may release more objects, and on a deferring thread
+        // those come back through Retire
+        for (Block* block : blocks) {
+            block->DestroyRetired();
+        }
+        return blocks.size();
+    }
+
+    static uint64_t Epoch() {
+        return State().epoch.load(std::memory_order_relaxed);
+    }
+
+    // Blocks retired by the calling thread and not handed off yet
+    static size_t RetiredOnThisThread() {
+        RetireList& list = local;
+        std::lock_guard own(list.mutex);
+        return list.blocks.size();
+    }
+
+    // Blocks handed off and waiting for the next Advance()
+    static size_t Pending() {
+        Shared& state = State();
+        std::lock_guard lock(state.mutex);
+        return state.pending.size();
+    }
+
+    // Runs Advance() every `period` on a background thread until Stop()
+    static void Start(std::chrono::microseconds period) {
+        Shared& state = State();
+        std::lock_guard lock(state.mutex);
+        if (state.reclaimer.joinable()) {
+            return;
+        }
+        state.stop = false;
+        state.reclaimer = std::thread([period, &state] {
+            std::unique_lock lock(state.mutex);
+            while (!state.stop) {
+                state.wake.wait_for(lock, period, [&state] { return state.stop; });
+                lock.unlock();
+                Advance();
+                lock.lock();
+            }
+        });
+    }
+
+    // Stops the background thread, which destroys what is pending on its way out
+    static void Stop() {
+        Shared& state = State();
+        std::thread reclaimer;
+        {
+            std::lock_guard lock(state.mutex);
+            state.stop = true;
+            reclaimer.swap(state.reclaimer);
+        }
+        state.wake.notify_all();
+        if (reclaimer.joinable()) {
+            reclaimer.join();
+        }
+    }
+
+private:
+    struct Shared;
+
+    // Registered in Shared for as long as its thread lives. Lock order: the mutex of Shared,
+    // then that of the list.
+    struct RetireList {
+        // Reserved, so that a push only allocates after a failed hand-off. A list that cannot
+        // be registered is only ever handed off by its own thread.
+        RetireList() {
+            Shared& state = State();
+            std::lock_guard lock(state.mutex);
+            try {
+                blocks.reserve(kBatch);
+            } catch (const std::bad_alloc&) {
+            }
+            try {
+                state.lists.push_back(this);
+            } catch (const std::bad_alloc&) {
+            }
+        }
+
+        // The thread exits; what it still holds goes to the next Advance()
+        ~RetireList() {
+            Shared& state = State();
+            {
+                std::lock_guard lock(state.mutex);
+                std::lock_guard own(mutex);
+                std::erase(state.lists, this);
+                if (HandOff(state)) {
+                    return;
+                }
+            }
+            // Nobody can reach the blocks, so they may as well go now
+            for (Block* block : blocks) {
+                block->DestroyRetired();
+            }
+        }
+
+        // Both locks held; false, with the blocks left in the list, if `pending` cannot grow
+        bool HandOff(Shared& state) noexcept {
+            std::vector<Block*>& pending = state.pending;
+            if (pending.capacity() - pending.size() < blocks.size()) {
+                try {
+                    size_t needed = pending.size() + blocks.size();
+                    pending.reserve(std::max(needed, 2 * pending.capacity()));
+                } catch (const std::bad_alloc&) {
+                    return false;
+                }
+            }
+            pending.insert(pending.end(), blocks.begin(), blocks.end());
+            blocks.clear();
+            return true;
+        }
+
+        std::mutex mutex;
+        std::vector<Block*> blocks;
+        // The epoch of the last Retire
+        uint64_t epoch = 0;
+    };
+
+    struct Shared {
+        std::atomic<uint64_t> epoch = 0;
+        std::mutex mutex;
+        std::vector<Block*> pending;
+        std::vector<RetireList*> lists;
+        std::condition_variable wake;
+        std::thread reclaimer;
+        bool stop = false;
+    };
+
+    // Leaked, so that blocks released by static destructors still find it
+    static Shared& State() {
+        static auto* state = new Shared;
+        return *state;
+    }
+
+    static inline thread_local RetireList local;
+};
@@ -2,154 +2,839 @@
 
 #include "sw_fwd.h"  // Forward declaration
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>  // std::nullptr_t
+#include <cstdint>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <memory>  // std::destroy_at
+#include <new>     // std::launder
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
-class BlockBase {
+// Strong counter of a control block. Increments are relaxed, decrements are release, and
+// only the thread that drops the counter to zero pays for an acquire (a load rather than a
+// fence, which ThreadSanitizer does not understand). With hazard pointers decrements are
+// seq_cst, which costs the same on x86 and ARMv8, see HazardPointers::RetireIfProtected.
+class AtomicStrongCounter {
 public:
-    BlockBase() {
+#ifdef SHARED_PTR_HAZARD_POINTERS
+    static constexpr std::memory_order kDecrement = std::memory_order_seq_cst;
+#else
+    static constexpr std::memory_order kDecrement = std::memory_order_release;
+#endif
+
+    void IncRef() {
+        count_.fetch_add(1, std::memory_order_relaxed);
     }
-    virtual void IncCounter() {
-        ++strong_count_;
+
+    // Takes a reference unless the count already dropped to zero, in which case the object is
+    // being destroyed or gone. Relaxed like IncRef: a nonzero count alone keeps the object alive.
+    bool IncRefIfNonZero() {
+        uint32_t count = count_.load(std::memory_order_relaxed);
+        do {
+            if (count == 0) {
+                return false;
+            }
+        } while (!count_.compare_exchange_weak(count, count + 1, std::memory_order_relaxed));
+        return true;
     }
-    virtual size_t GetCount() {
-        return strong_count_;
+
+    // Returns true when the last reference is gone and the object has to be destroyed
+    bool DecRef() {
+        if (count_.fetch_sub(1, kDecrement) == 1) {
+            count_.load(std::memory_order_acquire);
+            return true;
+        }
+        return false;
     }
 
-    virtual void DecCounter() {
-        --strong_count_;
+    // `n` references at once, with one read-modify-write
+    void IncRef(uint32_t n) {
+        count_.fetch_add(n, std::memory_order_relaxed);
+    }
+    bool DecRef(uint32_t n) {
+        if (count_.fetch_sub(n, kDecrement) == n) {
+            count_.load(std::memory_order_acquire);
+            return true;
+        }
+        return false;
     }
 
-    virtual void IncCounterWeak() {
-        ++weak_count_;
+    size_t RefCount() const {
+        return count_.load(std::memory_order_relaxed);
     }
-    virtual size_t GetCountWeak() {
-        return weak_count_;
+
+protected:
+    ~AtomicStrongCounter() = default;
+
+private:
+    // A fresh block is owned by the SharedPtr that created it
+    std::atomic<uint32_t> count_ = 1;
+};
+
+// Strong counter of LocalCounting blocks: the same interface as AtomicStrongCounter with plain
+// arithmetic. Every pointer to the object has to stay on one thread.
+class LocalStrongCounter {
+public:
+    void IncRef() {
+        ++count_;
     }
 
-    virtual void DecCounterWeak() {
-        --weak_count_;
+    bool IncRefIfNonZero() {
+        if (count_ == 0) {
+            return false;
+        }
+        ++count_;
+        return true;
     }
 
-    virtual ~BlockBase(){};
+    bool DecRef() {
+        return --count_ == 0;
+    }
+
+    void IncRef(uint32_t n) {
+        count_ += n;
+    }
+    bool DecRef(uint32_t n) {
+        count_ -= n;
+        return count_ == 0;
+    }
+
+    size_t RefCount() const {
+        return count_;
+    }
+
+protected:
+    ~LocalStrongCounter() = default;
 
 private:
-    size_t strong_count_ = 0;
-    size_t weak_count_ = 0;
+    uint32_t count_ = 1;
 };
 
-template <class T>
-class AllocatedByUser : public BlockBase {
+// The weak count of LocalCounting blocks, with the part of std::atomic's interface the block
+// uses, so that the block reads the same for every policy
+class PlainWeakCount {
 public:
-    AllocatedByUser() {
-        object_ = nullptr;
+    PlainWeakCount(uint32_t count) : count_(count) {
     }
 
-    AllocatedByUser(T* ptr) {
-        object_ = ptr;
+    uint32_t fetch_add(uint32_t n, std::memory_order) {
+        return std::exchange(count_, count_ + n);
+    }
+    uint32_t fetch_sub(uint32_t n, std::memory_order) {
+        return std::exchange(count_, count_ - n);
+    }
+    uint32_t load(std::memory_order) const {
+        return count_;
     }
 
-    size_t GetCount() override {
-        return strong_count_;
+private:
+    uint32_t count_;
+};
+
+// Counts references from the creating thread without atomics, see biased.h
+#include "biased.h"
+
+// Counting policies: the strong counter a block derives from, and whether its weak count is
+// atomic. SharedPtr/WeakPtr of different policies point to different block types, so they
+// never convert into each other; sw_fwd.h picks the default.
+struct LocalCounting {
+    using StrongCounter = LocalStrongCounter;
+    using WeakCount = PlainWeakCount;
+    static constexpr bool kAtomic = false;
+};
+
+struct AtomicCounting {
+    using StrongCounter = AtomicStrongCounter;
+    using WeakCount = std::atomic<uint32_t>;
+    static constexpr bool kAtomic = true;
+};
+
+struct BiasedCounting {
+    using StrongCounter = BiasedStrongCounter;
+    using WeakCount = std::atomic<uint32_t>;
+    static constexpr bool kAtomic = true;
+};
+
+// Build with SHARED_PTR_SLAB_BLOCKS to take blocks created with `new` from per-thread slab
+// caches instead of the global heap, see slab.h. The whole program has to agree on this too.
+#ifdef SHARED_PTR_SLAB_BLOCKS
+#include "slab.h"
+#endif
+
+// Build with SMART_PTR_INSTRUMENTATION to count block allocations, counter updates, promotions
+// and destructions per pointee type
+#include <common/refcount_stats.h>
+
+// Build with SHARED_PTR_BLOCK_REGISTRY to keep a list of every live block, see block_registry.h.
+// Meant for debug builds: each block grows by the list node and pays a mutex on creation and
+// destruction.
+#ifdef SHARED_PTR_BLOCK_REGISTRY
+#include "block_registry.h"
+
+#include <common/type_name.h>
+#endif
+
+// Build with SHARED_PTR_DEFERRED_RECLAMATION to let threads inside a DeferReleases scope leave
+// the destruction of objects they release last to an epoch-based reclaimer, see reclaim.h.
+#ifdef SHARED_PTR_DEFERRED_RECLAMATION
+#include "reclaim.h"
+#endif
+
+// Build with SHARED_PTR_HAZARD_POINTERS to let HazardGuard read objects through a WeakPtr
+// without touching their counters, see hazard.h. Only blocks of the default policy are
+// guarded, and biased or local counts cannot be read from other threads, so those do not mix.
+#ifdef SHARED_PTR_HAZARD_POINTERS
+#if defined(SHARED_PTR_BIASED_COUNTING) || defined(SHARED_PTR_LOCAL_COUNTING)
+#error "SHARED_PTR_HAZARD_POINTERS needs atomic strong counts"
+#endif
+#include "hazard.h"
+#endif
+
+// Control block shared by every SharedPtr/WeakPtr of one object.
+// Counters live here once and are updated inline; the derived blocks only say how to destroy
+// the object and how to free the block (and, rarely needed, where their deleter is), so a block
+// is one vptr and two 32-bit counters.
+// All strong references together own one weak reference, so the block is freed exactly once,
+// by whoever drops the weak counter to zero.
+// `Counting` is one of the counting policies above; the weak counter is atomic when the strong
+// one is.
+template <class Counting>
+class BasicBlock : public Counting::StrongCounter {
+    using StrongCounter = typename Counting::StrongCounter;
+
+public:
+    using CountingPolicy = Counting;
+
+    using StrongCounter::IncRef;
+    using StrongCounter::IncRefIfNonZero;
+    using StrongCounter::DecRef;
+    using StrongCounter::RefCount;
+
+    BasicBlock() {
     }
 
-    void IncCounter() override {
-        ++strong_count_;
+#ifdef SHARED_PTR_SLAB_BLOCKS
+    static void* operator new(size_t size) {
+        return SlabCache::Allocate(size);
+    }
+    static void operator delete(void* ptr, size_t size) {
+        SlabCache::Deallocate(ptr, size);
     }
 
-    void DecCounter() override {
-        --strong_count_;
-        if (strong_count_ == 0) {
-            delete object_;
-            object_ = nullptr;
-            if (weak_count_ == 0) {
-                delete this;
-            }
+    // Over-aligned objects do not fit the size classes
+    static void* operator new(size_t size, std::align_val_t align) {
+        return ::operator new(size, align);
+    }
+    static void operator delete(void* ptr, size_t size, std::align_val_t align) {
+        ::operator delete(ptr, size, align);
+    }
+#endif
+
+    void IncCounter() {
+        SMART_PTR_RECORD_SLOT(type_slot_, kStrongInc);
+        IncRef();
+    }
+    // A strong reference taken through a WeakPtr; fails once the object has expired
+    bool IncCounterIfNonZero() {
+        if (!IncRefIfNonZero()) {
+            return false;
         }
+        SMART_PTR_RECORD_SLOT(type_slot_, kStrongInc);
+        SMART_PTR_RECORD_SLOT(type_slot_, kPromotion);
+        return true;
+    }
+    size_t GetCount() const {
+        return RefCount();
     }
 
-    size_t GetCountWeak() override {
-        return weak_count_;
+    void DecCounter() {
+        SMART_PTR_RECORD_SLOT(type_slot_, kStrongDec);
+        if (DecRef()) {
+            ReleaseStrong();
+        }
+    }
+
+    // `n` strong references taken or dropped with one counter update
+    void IncCounter(uint32_t n) {
+        SMART_PTR_RECORD_SLOT(type_slot_, kStrongInc);
+        IncRef(n);
+    }
+    void DecCounter(uint32_t n) {
+        SMART_PTR_RECORD_SLOT(type_slot_, kStrongDec);
+        if (DecRef(n)) {
+            ReleaseStrong();
+        }
+    }
+    // DecCounter(n) for bulk releases that destroy the objects themselves, possibly on other
+    // threads: true means the count dropped to zero and ReleaseObject() is due
+    bool DecCounterKeepObject(uint32_t n) {
+        SMART_PTR_RECORD_SLOT(type_slot_, kStrongDec);
+        return DecRef(n);
+    }
+    void ReleaseObject() {
+        ReleaseStrong();
     }
 
-    void IncCounterWeak() override {
-        ++weak_count_;
+    void IncCounterWeak() {
+        SMART_PTR_RECORD_SLOT(type_slot_, kWeakInc);
+        weak_count_.fetch_add(1, std::memory_order_relaxed);
+    }
+    // Number of WeakPtr-s, not counting the reference held on behalf of the strong owners
+    size_t GetCountWeak() const {
+        return weak_count_.load(std::memory_order_relaxed) - (GetCount() > 0 ? 1 : 0);
     }
 
-    void DecCounterWeak() override {
-        --weak_count_;
-        if (weak_count_ == 0 && strong_count_ == 0) {
-            delete this;
+    void DecCounterWeak() {
+        SMART_PTR_RECORD_SLOT(type_slot_, kWeakDec);
+        if (weak_count_.fetch_sub(1, std::memory_order_release) == 1) {
+            weak_count_.load(std::memory_order_acquire);
+            Deallocate();
         }
     }
 
-    ~AllocatedByUser() override{};
+    // The deleter stored in the block if it has type `D`, null otherwise
+    template <class D>
+    D* FindDeleter() {
+        return static_cast<D*>(DeleterByTag(&kDeleterTag<D>));
+    }
+
+protected:
+    // Called by the constructor of the derived block, `bytes` being the size of its allocation
+    template <class Object>
+    void OnCreated([[maybe_unused]] size_t bytes) {
+#ifdef SMART_PTR_INSTRUMENTATION
+        type_slot_ = RefCountRegistry::SlotOf<Object>();
+        SMART_PTR_RECORD_SLOT(type_slot_, kAllocation);
+#endif
+#ifdef SHARED_PTR_BLOCK_REGISTRY
+        BlockRegistry<BasicBlock>::Register(registry_node_, this, TypeName<Object>(), bytes);
+#endif
+    }
+
+    // One distinct address per deleter type, so that no RTTI is needed to look a deleter up
+    template <class D>
+    static constexpr char kDeleterTag = 0;
+
+    virtual void* DeleterByTag(const void* /*tag*/) {
+        return nullptr;
+    }
+
+    // Called once, when the last strong reference goes away
+    virtual void DestroyObject() = 0;
+    // Called once, when the last weak reference goes away; frees the block itself
+    virtual void Deallocate() = 0;
+
+#ifdef SHARED_PTR_BLOCK_REGISTRY
+    ~BasicBlock() {
+        BlockRegistry<BasicBlock>::Unregister(registry_node_);
+    }
+#else
+    ~BasicBlock() = default;
+#endif
 
 private:
-    T* object_;
-    size_t strong_count_ = 0;
-    size_t weak_count_ = 0;
+    // Hazard pointers and deferred destruction serve the blocks of the default policy
+    static constexpr bool kDefault = std::is_same_v<Counting, DefaultCounting>;
+
+    // Also overrides BiasedStrongCounter's hook for merges done outside DecCounter
+    void ReleaseStrong() {
+#ifdef SHARED_PTR_HAZARD_POINTERS
+        if constexpr (kDefault) {
+            if (HazardPointers<BasicBlock>::RetireIfProtected(this)) {
+                return;
+            }
+        }
+#endif
+#ifdef SHARED_PTR_DEFERRED_RECLAMATION
+        if constexpr (kDefault && Counting::kAtomic) {
+            if (DeferReleases::Active() && EpochReclaimer<BasicBlock>::Retire(this)) {
+                return;
+            }
+        }
+#endif
+        DestroyRetired();
+    }
+
+    // Destroys the object and gives up the weak reference of the strong owners
+    void DestroyRetired() {
+        SMART_PTR_RECORD_SLOT(type_slot_, kDestruction);
+        DestroyObject();
+        DecCounterWeak();
+    }
+
+#ifdef SHARED_PTR_DEFERRED_RECLAMATION
+    friend class EpochReclaimer<BasicBlock>;
+#endif
+#ifdef SHARED_PTR_HAZARD_POINTERS
+    friend class HazardPointers<BasicBlock>;
+#endif
+
+    typename Counting::WeakCount weak_count_ = 1;
+
+#ifdef SMART_PTR_INSTRUMENTATION
+    // Set by OnCreated
+    RefCountRegistry::Slot type_slot_ = 0;
+#endif
+#ifdef SHARED_PTR_BLOCK_REGISTRY
+    typename BlockRegistry<BasicBlock>::Node registry_node_;
+#endif
+#ifdef SHARED_PTR_HAZARD_POINTERS
+    // Links the retired blocks, so that retiring never allocates
+    BasicBlock* retired_next_ = nullptr;
+#endif
 };
 
-template <class T>
-class AllocatedByOurselves : public BlockBase {
+// The block of SharedPtr<T>/WeakPtr<T>
+using BlockBase = BasicBlock<DefaultCounting>;
+
+#ifdef SHARED_PTR_BLOCK_REGISTRY
+// Every block alive right now, of every policy, in no particular order; of LocalCounting ones
+// only those of the calling thread
+inline std::vector<LiveBlock> TakeLiveBlocks() {
+    std::vector<LiveBlock> blocks;
+    auto add = [&blocks](std::vector<LiveBlock> more) {
+        blocks.insert(blocks.end(), std::make_move_iterator(more.begin()),
+                      std::make_move_iterator(more.end()));
+    };
+    add(BlockRegistry<BasicBlock<LocalCounting>>::Snapshot());
+    add(BlockRegistry<BasicBlock<AtomicCounting>>::Snapshot());
+    add(BlockRegistry<BasicBlock<BiasedCounting>>::Snapshot());
+    return blocks;
+}
+#endif
+
+#ifdef SHARED_PTR_DEFERRED_RECLAMATION
+inline DeferReleases::~DeferReleases() {
+    if (--depth == 0) {
+        EpochReclaimer<BlockBase>::Flush();
+    }
+}
+#endif
+
+// SharedPtr(ptr): `T` is an array type when the object came from `new[]`
+template <class T, class Counting = DefaultCounting>
+class AllocatedByUser final : public BasicBlock<Counting> {
+public:
+    AllocatedByUser() {
+        this->template OnCreated<std::remove_extent_t<T>>(sizeof(*this));
+        object_ = nullptr;
+    }
+
+    AllocatedByUser(std::remove_extent_t<T>* ptr) {
+        this->template OnCreated<std::remove_extent_t<T>>(sizeof(*this));
+        object_ = ptr;
+    }
+
+private:
+    void DestroyObject() override {
+        if constexpr (std::is_array_v<T>) {
+            delete[] object_;
+        } else {
+            delete object_;
+        }
+        object_ = nullptr;
+    }
+
+    void Deallocate() override {
+        delete this;
+    }
+
+    std::remove_extent_t<T>* object_;
+};
+
+// Tag for blocks that default-initialize their object, see MakeSharedForOverwrite
+struct DefaultInit {};
+
+template <class T, class Counting = DefaultCounting>
+class AllocatedByOurselves final : public BasicBlock<Counting> {
 public:
     template <typename... Args>
     AllocatedByOurselves(Args&&... args) {
+        this->template OnCreated<T>(sizeof(*this));
         ::new (&object_) T(std::forward<Args>(args)...);
     };
 
-    size_t GetCount() override {
-        return strong_count_;
-    }
+    explicit AllocatedByOurselves(DefaultInit) {
+        this->template OnCreated<T>(sizeof(*this));
+        ::new (&object_) T;
+    };
 
     T* GetObject() {
         return std::launder(reinterpret_cast<T*>(&object_));
     }
 
-    void IncCounter() override {
-        ++strong_count_;
+private:
+    void DestroyObject() override {
+        std::destroy_at(GetObject());
+    }
+
+    void Deallocate() override {
+        delete this;
     }
 
-    void DecCounter() override {
-        --strong_count_;
-        if (strong_count_ == 0) {
-            std::destroy_at(std::launder(reinterpret_cast<T*>(&object_)));
-            if (weak_count_ == 0) {
-                delete this;
+    std::aligned_storage_t<sizeof(T), alignof(T)> object_;
+};
+
+// MakeShared<T[]>: the elements follow the block in the same allocation.
+// Elements are constructed in order and destroyed in reverse order.
+template <class T, class Counting = DefaultCounting>
+class AllocatedArray final : public BasicBlock<Counting> {
+public:
+    // Every element is constructed as T(init...)
+    template <typename... Args>
+    static AllocatedArray* Create(size_t size, const Args&... init) {
+        return CreateWith(size, [&](void* element) { ::new (element) T(init...); });
+    }
+
+    // Elements are default-initialized, trivial ones are left as they are
+    static AllocatedArray* Create(size_t size, DefaultInit) {
+        return CreateWith(size, [](void* element) { ::new (element) T; });
+    }
+
+    T* GetObject() {
+        return std::launder(Storage());
+    }
+
+private:
+    explicit AllocatedArray(size_t size) : size_(size) {
+        this->template OnCreated<T>(Bytes(size));
+    }
+
+    template <typename Construct>
+    static AllocatedArray* CreateWith(size_t size, Construct construct) {
+        if (size > (SIZE_MAX - Offset()) / sizeof(T)) {
+            throw std::bad_array_new_length();
+        }
+        void* memory = AllocateBytes(Bytes(size));
+        auto* block = ::new (memory) AllocatedArray(size);
+        size_t constructed = 0;
+        try {
+            for (; constructed < size; ++constructed) {
+                construct(block->Storage() + constructed);
             }
+        } catch (...) {
+            block->DestroyElements(constructed);
+            block->~AllocatedArray();
+            DeallocateBytes(memory, Bytes(size));
+            throw;
         }
+        return block;
     }
 
-    size_t GetCountWeak() override {
-        return weak_count_;
+    static constexpr size_t Offset() {
+        return (sizeof(AllocatedArray) + alignof(T) - 1) / alignof(T) * alignof(T);
     }
 
-    void IncCounterWeak() override {
-        ++weak_count_;
+    static constexpr size_t Bytes(size_t size) {
+        return Offset() + size * sizeof(T);
     }
 
-    void DecCounterWeak() override {
-        --weak_count_;
-        if (weak_count_ == 0 && strong_count_ == 0) {
-            delete this;
+    static constexpr bool kOverAligned = alignof(T) > __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+
+    static void* AllocateBytes(size_t bytes) {
+        if constexpr (kOverAligned) {
+            return ::operator new(bytes, std::align_val_t(alignof(T)));
+        } else {
+            return ::operator new(bytes);
         }
     }
-    ~AllocatedByOurselves() override{
-        // std::destroy_at(std::launder(reinterpret_cast<T*>(&object_)));
-    };
+
+    static void DeallocateBytes(void* memory, size_t bytes) {
+        if constexpr (kOverAligned) {
+            ::operator delete(memory, bytes, std::align_val_t(alignof(T)));
+        } else {
+            ::operator delete(memory, bytes);
+        }
+    }
+
+    T* Storage() {
+        return reinterpret_cast<T*>(reinterpret_cast<char*>(this) + Offset());
+    }
+
+    void DestroyElements(size_t count) {
+        T* elements = GetObject();
+        while (count > 0) {
+            std::destroy_at(elements + --count);
+        }
+    }
+
+    void DestroyObject() override {
+        DestroyElements(size_);
+    }
+
+    void Deallocate() override {
+        size_t bytes = Bytes(size_);
+        this->~AllocatedArray();
+        DeallocateBytes(this, bytes);
+    }
+
+    size_t size_;
+};
+
+// Blocks below are allocated from a user-supplied allocator. Each keeps a copy of it, rebound
+// to its own type, so that the block goes back to the allocator it came from.
+// Allocators must hand out raw pointers.
+
+// Allocates a block of type `Block` from `alloc` and constructs it in place
+template <class Block, class Alloc, typename... Args>
+Block* NewBlock(const Alloc& alloc, Args&&... args) {
+    using Traits = std::allocator_traits<typename Block::BlockAllocator>;
+    typename Block::BlockAllocator block_alloc(alloc);
+    Block* block = Traits::allocate(block_alloc, 1);
+    try {
+        ::new (static_cast<void*>(block)) Block(block_alloc, std::forward<Args>(args)...);
+    } catch (...) {
+        Traits::deallocate(block_alloc, block, 1);
+        throw;
+    }
+    return block;
+}
+
+// Deleters and allocators stored in a block. Empty ones become empty bases and take no space,
+// so a stateless deleter costs nothing over `delete`. `Tag` keeps two slots of one type apart.
+template <class V, int Tag, bool = std::is_empty_v<V> && !std::is_final_v<V>>
+class InlineSlot {
+public:
+    explicit InlineSlot(V value) : value_(std::move(value)) {
+    }
+
+    V& Get() {
+        return value_;
+    }
+
+private:
+    V value_;
+};
+
+template <class V, int Tag>
+class InlineSlot<V, Tag, true> : private V {
+public:
+    explicit InlineSlot(V value) : V(std::move(value)) {
+    }
+
+    V& Get() {
+        return *this;
+    }
+};
+
+// Allocator for blocks of SharedPtr(ptr, deleter): the heap, or the slab cache in slab mode
+template <class T>
+struct DefaultBlockAllocator {
+    using value_type = T;
+
+    DefaultBlockAllocator() = default;
+
+    template <class U>
+    DefaultBlockAllocator(const DefaultBlockAllocator<U>&) noexcept {
+    }
+
+    T* allocate(size_t n) {
+        static_assert(alignof(T) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "over-aligned deleter");
+#ifdef SHARED_PTR_SLAB_BLOCKS
+        return static_cast<T*>(SlabCache::Allocate(n * sizeof(T)));
+#else
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+#endif
+    }
+
+    void deallocate(T* ptr, size_t n) {
+#ifdef SHARED_PTR_SLAB_BLOCKS
+        SlabCache::Deallocate(ptr, n * sizeof(T));
+#else
+        ::operator delete(ptr, n * sizeof(T));
+#endif
+    }
+
+    template <class U>
+    bool operator==(const DefaultBlockAllocator<U>&) const {
+        return true;
+    }
+};
+
+// SharedPtr(ptr, deleter[, alloc]): the object is the user's, the block is the allocator's
+template <class T, class Deleter, class Alloc, class Counting = DefaultCounting>
+class AllocatedByUserWithDeleter final
+    : public BasicBlock<Counting>,
+      private InlineSlot<Deleter, 0>,
+      private InlineSlot<typename std::allocator_traits<Alloc>::template rebind_alloc<
+                             AllocatedByUserWithDeleter<T, Deleter, Alloc, Counting>>,
+                         1> {
+public:
+    using BlockAllocator =
+        typename std::allocator_traits<Alloc>::template rebind_alloc<AllocatedByUserWithDeleter>;
+
+    AllocatedByUserWithDeleter(const BlockAllocator& alloc, T* ptr, Deleter deleter)
+        : DeleterSlot(std::move(deleter)), AllocatorSlot(alloc), object_(ptr) {
+        this->template OnCreated<T>(sizeof(*this));
+    }
 
 private:
+    using DeleterSlot = InlineSlot<Deleter, 0>;
+    using AllocatorSlot = InlineSlot<BlockAllocator, 1>;
+
+    void DestroyObject() override {
+        DeleterSlot::Get()(object_);
+    }
+
+    void Deallocate() override {
+        // The allocator lives inside the block, take it out before the block goes away
+        BlockAllocator alloc(std::move(AllocatorSlot::Get()));
+        this->~AllocatedByUserWithDeleter();
+        std::allocator_traits<BlockAllocator>::deallocate(alloc, this, 1);
+    }
+
+    void* DeleterByTag(const void* tag) override {
+        return tag == &BasicBlock<Counting>::template kDeleterTag<Deleter> ? &DeleterSlot::Get()
+                                                                            : nullptr;
+    }
+
+    T* object_;
+};
+
+// AllocateShared: like AllocatedByOurselves, one allocation, but from the user's allocator
+template <class T, class Alloc, class Counting = DefaultCounting>
+class AllocatedByAllocator final
+    : public BasicBlock<Counting>,
+      private InlineSlot<typename std::allocator_traits<Alloc>::template rebind_alloc<
+                             AllocatedByAllocator<T, Alloc, Counting>>,
+                         0> {
+public:
+    using BlockAllocator =
+        typename std::allocator_traits<Alloc>::template rebind_alloc<AllocatedByAllocator>;
+
+    template <typename... Args>
+    AllocatedByAllocator(const BlockAllocator& alloc, Args&&... args) : AllocatorSlot(alloc) {
+        this->template OnCreated<T>(sizeof(*this));
+        ObjectAllocator object_alloc(AllocatorSlot::Get());
+        auto* storage = reinterpret_cast<std::remove_cv_t<T>*>(&object_);
+        std::allocator_traits<ObjectAllocator>::construct(object_alloc, storage,
+                                                          std::forward<Args>(args)...);
+    }
+
+    T* GetObject() {
+        return std::launder(reinterpret_cast<T*>(&object_));
+    }
+
+private:
+    using AllocatorSlot = InlineSlot<BlockAllocator, 0>;
+    using ObjectAllocator = typename std::allocator_traits<Alloc>::template rebind_alloc<
+        std::remove_cv_t<T>>;
+
+    void DestroyObject() override {
+        ObjectAllocator object_alloc(AllocatorSlot::Get());
+        std::allocator_traits<ObjectAllocator>::destroy(
+            object_alloc, const_cast<std::remove_cv_t<T>*>(GetObject()));
+    }
+
+    void Deallocate() override {
+        BlockAllocator alloc(std::move(AllocatorSlot::Get()));
+        this->~AllocatedByAllocator();
+        std::allocator_traits<BlockAllocator>::deallocate(alloc, this, 1);
+    }
+
     std::aligned_storage_t<sizeof(T), alignof(T)> object_;
-    // T object_;
-    size_t strong_count_ = 0;
-    size_t weak_count_ = 0;
 };
 
+// The part of EnableSharedFromThis that SharedPtr fills in: a weak reference to the block that
+// owns the object. It is taken when the first owner is created, and dropped together with the
+// object, so SharedFromThis only has to bump the strong count. An object that outlives its
+// owners, e.g. one handed back to a pool by its deleter, is linked to the block of its next
+// owner. Only owners of the same counting policy fill it in.
+template <class Counting>
+class EnableSharedFromThisBase {
+protected:
+    EnableSharedFromThisBase() noexcept {
+    }
+
+    // A copy is a different object with owners of its own
+    EnableSharedFromThisBase(const EnableSharedFromThisBase&) noexcept {
+    }
+    EnableSharedFromThisBase& operator=(const EnableSharedFromThisBase&) noexcept {
+        return *this;
+    }
+
+    ~EnableSharedFromThisBase() {
+        if (weak_block_ != nullptr) {
+            weak_block_->DecCounterWeak();
+        }
+    }
+
+    BasicBlock<Counting>* WeakBlock() const {
+        return weak_block_;
+    }
+
+private:
+    template <typename Y, class C>
+    friend void LinkSharedFromThis(Y* object, BasicBlock<C>* block);
+
+    void Link(BasicBlock<Counting>* block) const {
+        if (weak_block_ != nullptr) {
+            if (weak_block_->GetCount() != 0) {
+                return;
+            }
+            // The previous owners are gone
+            weak_block_->DecCounterWeak();
+        }
+        block->IncCounterWeak();
+        weak_block_ = block;
+    }
+
+    mutable BasicBlock<Counting>* weak_block_ = nullptr;
+};
+
+// Called with every new owning block; a no-op unless `Y` has one unambiguous
+// EnableSharedFromThis base of the block's policy
+template <typename Y, class Counting>
+void LinkSharedFromThis(Y* object, BasicBlock<Counting>* block) {
+    using Base = EnableSharedFromThisBase<Counting>;
+    if constexpr (std::is_convertible_v<Y*, const Base*>) {
+        if (object != nullptr) {
+            static_cast<const Base*>(object)->Link(block);
+        }
+    }
+}
+
+// The standard's "`Y*` is compatible with `T*`": SharedPtr<Y> converts to SharedPtr<T>. It keeps
+// arrays apart unless their element types match, and arrays apart from single objects.
+template <typename Y, typename T>
+inline constexpr bool kIsCompatible = std::is_convertible_v<Y*, T*>;
+
+// `Y*`, as returned by `new` or `new[]`, may be owned by SharedPtr<T>; an array of derived
+// objects never passes for an array of bases, which would be indexed with the wrong stride
+template <typename Y, typename T>
+inline constexpr bool kIsOwnable = !std::is_array_v<Y> && std::is_convertible_v<Y*, T*>;
+template <typename Y, typename U>
+inline constexpr bool kIsOwnable<Y, U[]> = std::is_convertible_v<Y (*)[], U (*)[]>;
+template <typename Y, typename U, size_t N>
+inline constexpr bool kIsOwnable<Y, U[N]> = std::is_convertible_v<Y (*)[N], U (*)[N]>;
+
+template <typename Ptr>
+inline constexpr bool kIsSharedPtr = false;
+template <typename T, class Counting>
+inline constexpr bool kIsSharedPtr<SharedPtr<T, Counting>> = true;
+
+template <std::forward_iterator It>
+requires kIsSharedPtr<std::iter_value_t<It>>
+void ReleaseAll(It first, It last, size_t threads = 1);
+
+template <typename T, class Counting = DefaultCounting>
+class EnableSharedFromThis;
+
 // https://en.cppreference.com/w/cpp/memory/shared_ptr
-template <typename T>
+template <typename T, class Counting>
 class SharedPtr {
 public:
+    // `T` itself for objects, the element type for arrays
+    using ElementType = std::remove_extent_t<T>;
+    using BlockType = BasicBlock<Counting>;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
 
@@ -161,156 +846,164 @@ public:
         object_ = nullptr;
         block_ = nullptr;
     };
-    explicit SharedPtr(T* ptr) {
+    explicit SharedPtr(ElementType* ptr) requires(!std::is_array_v<T>) {
         object_ = ptr;
-        AllocatedByUser<T>* block = new AllocatedByUser<T>(ptr);
-        block_ = block;
-        block_->IncCounter();
+        block_ = NewUserBlock(ptr);
     };
 
     template <class Y>
+    requires kIsOwnable<Y, T>
     explicit SharedPtr(Y* ptr) {
         object_ = ptr;
-        AllocatedByUser<Y>* block = new AllocatedByUser<Y>(ptr);
-        block_ = block;
-        block_->IncCounter();
+        block_ = NewUserBlock(ptr);
+    };
+
+    // The deleter is stored in the block, which is the only allocation
+    template <class Y, class Deleter>
+    requires kIsOwnable<Y, T>
+    SharedPtr(Y* ptr, Deleter deleter)
+        : SharedPtr(ptr, std::move(deleter), DefaultBlockAllocator<Y>()) {
+    }
+
+    // The block comes from `alloc`; if that throws, `ptr` is passed to `deleter`
+    template <class Y, class Deleter, class Alloc>
+    requires kIsOwnable<Y, T>
+    SharedPtr(Y* ptr, Deleter deleter, Alloc alloc) {
+        using Block = AllocatedByUserWithDeleter<Y, Deleter, Alloc, Counting>;
+        try {
+            block_ = NewBlock<Block>(alloc, ptr, deleter);
+        } catch (...) {
+            deleter(ptr);
+            throw;
+        }
+        object_ = ptr;
+        if constexpr (!std::is_array_v<T>) {
+            LinkSharedFromThis(ptr, block_);
+        }
     };
 
     SharedPtr(const SharedPtr& other) {
         object_ = other.Get();
         block_ = other.block_;
-        if (Get() != nullptr) {
+        if (block_ != nullptr) {
             block_->IncCounter();
         }
     };
 
     template <class Y>
-    SharedPtr(const SharedPtr<Y>& other) {
+    requires kIsCompatible<Y, T>
+    SharedPtr(const SharedPtr<Y, Counting>& other) {
         object_ = other.Get();
         block_ = other.GetBlock();
-        if (Get() != nullptr) {
+        if (block_ != nullptr) {
             block_->IncCounter();
         }
     };
 
+    // Moves take the reference over from `other`, so they never touch the counters
     template <class Y>
-    SharedPtr(SharedPtr<Y>&& other) {
-        object_ = other.Get();
-        block_ = other.GetBlock();
-        block_->IncCounter();
-        other.Reset();
+    requires kIsCompatible<Y, T>
+    SharedPtr(SharedPtr<Y, Counting>&& other) noexcept {
+        object_ = other.object_;
+        block_ = other.block_;
+        other.object_ = nullptr;
+        other.block_ = nullptr;
     };
 
-    SharedPtr(SharedPtr&& other) {
-        object_ = other.Get();
+    SharedPtr(SharedPtr&& other) noexcept {
+        object_ = other.object_;
+        block_ = other.block_;
+        other.object_ = nullptr;
+        other.block_ = nullptr;
+    };
+
+    // Aliasing constructor
+    // #8 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
+    template <typename Y>
+    SharedPtr(const SharedPtr<Y, Counting>& other, ElementType* ptr) {
+        object_ = ptr;
         block_ = other.GetBlock();
         if (block_ != nullptr) {
             block_->IncCounter();
         }
     };
 
-    // Aliasing constructor
-    // #8 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
+    // Takes the reference over from `other`, which is left empty, so projecting a temporary
+    // into one of its members never touches the counters
     template <typename Y>
-    SharedPtr(const SharedPtr<Y>& other, T* ptr) {
+    SharedPtr(SharedPtr<Y, Counting>&& other, ElementType* ptr) noexcept {
         object_ = ptr;
-        block_ = other.GetBlock();
-        block_->IncCounter();
+        block_ = other.block_;
+        other.object_ = nullptr;
+        other.block_ = nullptr;
     };
 
+    // MakeShared: the object is built in the block. A tag rather than a flag, so that pointers
+    // the other constructors reject are not taken for one.
     template <typename... Args>
-    SharedPtr(bool f, Args&&... args) {
-        AllocatedByOurselves<T>* block = new AllocatedByOurselves<T>(std::forward<Args>(args)...);
-        object_ = nullptr;
+    SharedPtr(std::in_place_t, Args&&... args) {
+        auto* block = new AllocatedByOurselves<T, Counting>(std::forward<Args>(args)...);
+        object_ = block->GetObject();
         block_ = block;
-        block_->IncCounter();
+        LinkSharedFromThis(object_, block_);
     };
 
-    // Promote `WeakPtr`
+    // Promote `WeakPtr`; throws BadWeakPtr if it is empty or has expired
     // #11 from https://en.cppreference.com/w/cpp/memory/shared_ptr/shared_ptr
     template <class Y>
-    explicit SharedPtr(const WeakPtr<Y>& other) {
-        if (other.UseCount() == 0) {
-            BadWeakPtr b;
-            throw b;
-        }
-        object_ = other.Get();
-        block_ = other.GetBlock();
-        if (Get() != nullptr) {
-            block_->IncCounter();
+    requires kIsCompatible<Y, T>
+    explicit SharedPtr(const WeakPtr<Y, Counting>& other) : SharedPtr(other.TryLock()) {
+        if (block_ == nullptr) {
+            throw BadWeakPtr();
         }
     };
 
-    explicit SharedPtr(const WeakPtr<T>& other) {
-        if (other.UseCount() == 0) {
-            BadWeakPtr b;
-            throw b;
-        }
-        object_ = other.Get();
-        block_ = other.GetBlock();
-        if (Get() != nullptr) {
-            block_->IncCounter();
+    explicit SharedPtr(const WeakPtr<T, Counting>& other) : SharedPtr(other.TryLock()) {
+        if (block_ == nullptr) {
+            throw BadWeakPtr();
         }
     };
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // `operator=`-s
 
+    // The new reference is taken before the old one is dropped, so self-assignment is safe.
     SharedPtr& operator=(const SharedPtr& other) {
-        if (Get() == nullptr) {
-            object_ = other.object_;
-            block_ = other.block_;
-        } else {
-            object_ = other.object_;
-            block_->DecCounter();
-            block_ = other.block_;
+        if (other.block_ != nullptr) {
+            other.block_->IncCounter();
         }
-        if (Get() != nullptr) {
-            block_->IncCounter();
+        if (block_ != nullptr) {
+            block_->DecCounter();
         }
+        object_ = other.object_;
+        block_ = other.block_;
         return *this;
     };
 
     template <class Y>
-    SharedPtr& operator=(const SharedPtr<Y>& other) {
-        if (Get() == nullptr) {
-            object_ = other.Get();
-            block_ = other.GetBlock();
-        } else {
-            object_ = other.Get();
-            block_->DecCounter();
-            block_ = other.GetBlock();
+    requires kIsCompatible<Y, T>
+    SharedPtr& operator=(const SharedPtr<Y, Counting>& other) {
+        if (other.GetBlock() != nullptr) {
+            other.GetBlock()->IncCounter();
         }
-        if (Get() != nullptr) {
-            block_->IncCounter();
-        }
-        return *this;
-    };
-
-    SharedPtr& operator=(SharedPtr&& other) {
-        if (Get() != nullptr) {
+        if (block_ != nullptr) {
             block_->DecCounter();
         }
         object_ = other.Get();
         block_ = other.GetBlock();
-        if (object_ != nullptr) {
-            block_->IncCounter();
-        }
-        other.Reset();
+        return *this;
+    };
+
+    // The old reference is released by the temporary; self-move leaves the pointer as it was
+    SharedPtr& operator=(SharedPtr&& other) noexcept {
+        SharedPtr(std::move(other)).Swap(*this);
         return *this;
     };
 
     template <class Y>
-    SharedPtr& operator=(SharedPtr<Y>&& other) {
-        if (Get() != nullptr) {
-            block_->DecCounter();
-        }
-        object_ = other.Get();
-        block_ = other.GetBlock();
-        if (object_ != nullptr) {
-            block_->IncCounter();
-        }
-        other.Reset();
+    requires kIsCompatible<Y, T>
+    SharedPtr& operator=(SharedPtr<Y, Counting>&& other) noexcept {
+        SharedPtr(std::move(other)).Swap(*this);
         return *this;
     };
 
@@ -318,7 +1011,7 @@ public:
     // Destructor
 
     ~SharedPtr() {
-        if ((object_ != nullptr || block_ != nullptr) && block_->GetCount() > 0) {
+        if (block_ != nullptr) {
             block_->DecCounter();
         }
     };
@@ -327,7 +1020,7 @@ public:
     // Modifiers
 
     void Reset() noexcept {
-        if (object_ != nullptr) {
+        if (block_ != nullptr) {
             object_ = nullptr;
             block_->DecCounter();
             block_ = nullptr;
@@ -335,56 +1028,100 @@ public:
     };
 
     template <class Y>
+    requires kIsOwnable<Y, T>
     void Reset(Y* ptr) {
-        if (object_ != nullptr) {
+        if (block_ != nullptr) {
             block_->DecCounter();
         }
         object_ = ptr;
-        AllocatedByUser<Y>* block = new AllocatedByUser<Y>(ptr);
-        block_ = block;
-        block_->IncCounter();
+        block_ = NewUserBlock(ptr);
+    };
+
+    template <class Y, class Deleter>
+    requires kIsOwnable<Y, T>
+    void Reset(Y* ptr, Deleter deleter) {
+        SharedPtr(ptr, std::move(deleter)).Swap(*this);
     };
 
-    void Swap(SharedPtr& other) {
+    void Swap(SharedPtr& other) noexcept {
         std::swap(object_, other.object_);
         std::swap(block_, other.block_);
     };
 
     ////////////////////////////////////////////////////////////////////////////////////////////////
-    // Observers
+    // Batches
 
-    T* Get() const {
-        if (UseCount() == 0) {
-            return nullptr;
+    // Writes `n` new owners of the object to `out`, taking their references with one counter
+    // update instead of `n`. An empty pointer gives empty ones. Throws std::length_error, before
+    // writing anything, if `n` does not fit the 32-bit count.
+    // ReleaseN gives such a batch back the same way.
+    template <class OutputIt>
+    OutputIt ShareN(size_t n, OutputIt out) const {
+        CheckBatchSize(n);
+        if (block_ == nullptr) {
+            for (size_t i = 0; i < n; ++i, ++out) {
+                *out = SharedPtr();
+            }
+            return out;
         }
-        if (block_ != nullptr && object_ == nullptr) {
-            AllocatedByOurselves<T>* block = dynamic_cast<AllocatedByOurselves<T>*>(block_);
-            return block->GetObject();
-        } else {
-            return object_;
+        if (n == 0) {
+            return out;
         }
+        block_->IncCounter(static_cast<uint32_t>(n));
+        size_t handed = 0;
+        try {
+            for (; handed < n; ++handed, ++out) {
+                // If the write throws, the temporary still drops its own reference
+                *out = SharedPtr(AdoptBlock{}, object_, block_);
+            }
+        } catch (...) {
+            if (handed + 1 < n) {
+                // `*this` still owns one, so this never destroys the object
+                block_->DecCounter(static_cast<uint32_t>(n - handed - 1));
+            }
+            throw;
+        }
+        return out;
+    }
+
+    std::vector<SharedPtr> ShareN(size_t n) const {
+        CheckBatchSize(n);
+        std::vector<SharedPtr> shared;
+        shared.reserve(n);
+        ShareN(n, std::back_inserter(shared));
+        return shared;
+    }
+
+    ////////////////////////////////////////////////////////////////////////////////////////////////
+    // Observers
+
+    // The stored pointer is always valid (MakeShared points it into its block),
+    // so observers never touch the control block.
+    ElementType* Get() const {
+        return object_;
     };
 
-    BlockBase* GetBlock() const {
+    BlockType* GetBlock() const {
         return block_;
     }
 
-    T& operator*() const {
-        if (block_ != nullptr && object_ == nullptr) {
-            AllocatedByOurselves<T>* block = dynamic_cast<AllocatedByOurselves<T>*>(block_);
-            return *(block->GetObject());
-        } else {
-            return *object_;
-        }
+    // The deleter this object was created with if it has type `D`, null otherwise
+    // https://en.cppreference.com/w/cpp/memory/shared_ptr/get_deleter
+    template <class D>
+    D* GetDeleter() const {
+        return block_ != nullptr ? block_->template FindDeleter<D>() : nullptr;
+    }
+
+    T& operator*() const requires(!std::is_array_v<T>) {
+        return *object_;
     };
 
-    T* operator->() const {
-        if (block_ != nullptr && object_ == nullptr) {
-            AllocatedByOurselves<T>* block = dynamic_cast<AllocatedByOurselves<T>*>(block_);
-            return block->GetObject();
-        } else {
-            return object_;
-        }
+    T* operator->() const requires(!std::is_array_v<T>) {
+        return object_;
+    };
+
+    ElementType& operator[](std::ptrdiff_t index) const requires std::is_array_v<T> {
+        return object_[index];
     };
 
     size_t UseCount() const {
@@ -400,29 +1137,365 @@ public:
     };
 
 private:
-    T* object_;
-    BlockBase* block_;
+    template <typename Y, class C>
+    friend class SharedPtr;
+    template <typename Y, class C>
+    friend SharedPtr<Y, C> FromFreshBlock(typename SharedPtr<Y, C>::ElementType* object,
+                                          BasicBlock<C>* block);
+    template <typename Y, class C>
+    friend class EnableSharedFromThis;
+    template <typename Y, class C>
+    friend class WeakPtr;
+    template <std::forward_iterator It>
+    requires kIsSharedPtr<std::iter_value_t<It>>
+    friend void ReleaseN(It first, It last);
+    template <std::forward_iterator It>
+    requires kIsSharedPtr<std::iter_value_t<It>>
+    friend void ReleaseAll(It first, It last, size_t threads);
+
+    struct AdoptBlock {};
+
+    static void CheckBatchSize(size_t n) {
+        if (n > std::numeric_limits<uint32_t>::max()) {
+            throw std::length_error("ShareN: more references than the count holds");
+        }
+    }
+
+    // Takes over the reference a freshly made block starts with
+    SharedPtr(AdoptBlock, ElementType* object, BlockType* block) noexcept {
+        object_ = object;
+        block_ = block;
+    };
+
+    // Arrays from `new[]` go back through `delete[]`
+    template <class Y>
+    static BlockType* NewUserBlock(Y* ptr) {
+        if constexpr (std::is_array_v<T>) {
+            return new AllocatedByUser<Y[], Counting>(ptr);
+        } else {
+            BlockType* block = new AllocatedByUser<Y, Counting>(ptr);
+            LinkSharedFromThis(ptr, block);
+            return block;
+        }
+    }
+
+    ElementType* object_;
+    BlockType* block_;
 };
 
-template <typename T, typename U>
-inline bool operator==(const SharedPtr<T>& left, const SharedPtr<U>& right) {
+template <typename T, typename U, class Counting>
+inline bool operator==(const SharedPtr<T, Counting>& left, const SharedPtr<U, Counting>& right) {
     return left.Get() == right.Get();
 };
 
+// Casts, https://en.cppreference.com/w/cpp/memory/shared_ptr/pointer_cast
+// The result shares the block of `ptr`; the rvalue overloads move the block over and touch no
+// counter. A failed DynamicPointerCast returns an empty pointer and leaves `ptr` as it was.
+template <typename T, typename U, class Counting>
+SharedPtr<T, Counting> StaticPointerCast(const SharedPtr<U, Counting>& ptr) noexcept {
+    using Element = typename SharedPtr<T, Counting>::ElementType;
+    return SharedPtr<T, Counting>(ptr, static_cast<Element*>(ptr.Get()));
+};
+template <typename T, typename U, class Counting>
+SharedPtr<T, Counting> StaticPointerCast(SharedPtr<U, Counting>&& ptr) noexcept {
+    using Element = typename SharedPtr<T, Counting>::ElementType;
+    auto* object = static_cast<Element*>(ptr.Get());
+    return SharedPtr<T, Counting>(std::move(ptr), object);
+};
+
+template <typename T, typename U, class Counting>
+SharedPtr<T, Counting> DynamicPointerCast(const SharedPtr<U, Counting>& ptr) noexcept {
+    using Element = typename SharedPtr<T, Counting>::ElementType;
+    if (auto* object = dynamic_cast<Element*>(ptr.Get())) {
+        return SharedPtr<T, Counting>(ptr, object);
+    }
+    return SharedPtr<T, Counting>();
+};
+template <typename T, typename U, class Counting>
+SharedPtr<T, Counting> DynamicPointerCast(SharedPtr<U, Counting>&& ptr) noexcept {
+    using Element = typename SharedPtr<T, Counting>::ElementType;
+    if (auto* object = dynamic_cast<Element*>(ptr.Get())) {
+        return SharedPtr<T, Counting>(std::move(ptr), object);
+    }
+    return SharedPtr<T, Counting>();
+};
+
+template <typename T, typename U, class Counting>
+SharedPtr<T, Counting> ConstPointerCast(const SharedPtr<U, Counting>& ptr) noexcept {
+    using Element = typename SharedPtr<T, Counting>::ElementType;
+    return SharedPtr<T, Counting>(ptr, const_cast<Element*>(ptr.Get()));
+};
+template <typename T, typename U, class Counting>
+SharedPtr<T, Counting> ConstPointerCast(SharedPtr<U, Counting>&& ptr) noexcept {
+    using Element = typename SharedPtr<T, Counting>::ElementType;
+    auto* object = const_cast<Element*>(ptr.Get());
+    return SharedPtr<T, Counting>(std::move(ptr), object);
+};
+
+template <typename T, typename U, class Counting>
+SharedPtr<T, Counting> ReinterpretPointerCast(const SharedPtr<U, Counting>& ptr) noexcept {
+    using Element = typename SharedPtr<T, Counting>::ElementType;
+    return SharedPtr<T, Counting>(ptr, reinterpret_cast<Element*>(ptr.Get()));
+};
+template <typename T, typename U, class Counting>
+SharedPtr<T, Counting> ReinterpretPointerCast(SharedPtr<U, Counting>&& ptr) noexcept {
+    using Element = typename SharedPtr<T, Counting>::ElementType;
+    auto* object = reinterpret_cast<Element*>(ptr.Get());
+    return SharedPtr<T, Counting>(std::move(ptr), object);
+};
+
+// Empties the pointers in [first, last); every run of consecutive pointers to one block drops
+// its references with one counter update, so a batch made by ShareN costs one in total
+template <std::forward_iterator It>
+requires kIsSharedPtr<std::iter_value_t<It>>
+void ReleaseN(It first, It last) {
+    while (first != last) {
+        auto* block = first->block_;
+        uint32_t run = 0;
+        for (; first != last && first->block_ == block; ++first) {
+            first->object_ = nullptr;
+            first->block_ = nullptr;
+            ++run;
+        }
+        if (block != nullptr) {
+            block->DecCounter(run);
+        }
+    }
+};
+
+// Batches smaller than this are destroyed on the calling thread whatever ReleaseAll is told
+inline constexpr size_t kMinParallelRelease = 1024;
+inline constexpr size_t kMaxReleaseTable = size_t{1} << 16;
+
+// Empties the pointers in [first, last) with one counter update per distinct block, wherever
+// its pointers are in the range. The counts are gathered in an open-addressing table keyed by
+// block, which grows up to kMaxReleaseTable slots (1 MiB); once it is full, pointers to blocks
+// that are not in it yet are released one by one, so a range of mostly distinct blocks costs
+// little more than destroying the pointers; the gain is on ranges with many pointers per block.
+// Objects whose last reference was in the range are destroyed at the end; with `threads` > 1
+// on that many threads, the calling one included, unless their counting policy is local.
+template <std::forward_iterator It>
+requires kIsSharedPtr<std::iter_value_t<It>>
+void ReleaseAll(It first, It last, size_t threads) {
+    using Block = typename std::iter_value_t<It>::BlockType;
+    if constexpr (!Block::CountingPolicy::kAtomic) {
+        threads = 1;
+    }
+    struct Slot {
+        Block* block = nullptr;
+        uint32_t count = 0;
+    };
+    int bits = 10;
+    std::vector<Slot> table(size_t{1} << bits);
+    size_t used = 0;
+    // Fibonacci hashing; blocks are at least 16 bytes apart
+    auto find = [&table, &bits](Block* block) -> Slot& {
+        size_t i = (reinterpret_cast<uintptr_t>(block) >> 4) * 0x9E3779B97F4A7C15ull >> (64 - bits);
+        while (table[i].block != nullptr && table[i].block != block) {
+            i = (i + 1) & (table.size() - 1);
+        }
+        return table[i];
+    };
+
+    // Never throws: the pointers handed in are already empty, so a count that is not applied
+    // would leak its object. Without memory for the list, an object is destroyed right here.
+    std::vector<Block*> dead;
+    auto release = [&dead, threads](Block* block, uint32_t count) noexcept {
+        if (!block->DecCounterKeepObject(count)) {
+            return;
+        }
+        if (threads > 1) {
+            try {
+                dead.push_back(block);
+                return;
+            } catch (const std::bad_alloc&) {
+            }
+        }
+        block->ReleaseObject();
+    };
+    bool full = false;
+
+    for (; first != last; ++first) {
+        Block* block = std::exchange(first->block_, nullptr);
+        first->object_ = nullptr;
+        if (block == nullptr) {
+            continue;
+        }
+        Slot* slot = &find(block);
+        if (slot->block == nullptr) {
+            if (4 * (used + 1) > 3 * table.size()) {
+                if (full || table.size() >= kMaxReleaseTable) {
+                    release(block, 1);
+                    continue;
+                }
+                std::vector<Slot> old;
+                try {
+                    old.resize(size_t{2} << bits);
+                } catch (const std::bad_alloc&) {
+                    // The table stays as it is, like one that reached kMaxReleaseTable
+                    full = true;
+                    release(block, 1);
+                    continue;
+                }
+                old.swap(table);
+                ++bits;
+                for (const Slot& moved : old) {
+                    if (moved.block != nullptr) {
+                        find(moved.block) = moved;
+                    }
+                }
+                slot = &find(block);
+            }
+            slot->block = block;
+            ++used;
+        }
+        ++slot->count;
+    }
+    for (const Slot& slot : table) {
+        if (slot.block != nullptr) {
+            release(slot.block, slot.count);
+        }
+    }
+
+    threads = std::clamp<size_t>(threads, 1, dead.size() / kMinParallelRelease + 1);
+    auto destroy = [&dead, threads](size_t part) {
+        for (size_t i = part; i < dead.size(); i += threads) {
+            dead[i]->ReleaseObject();
+        }
+    };
+    std::vector<std::thread> helpers;
+    size_t part = 1;
+    try {
+        helpers.reserve(threads - 1);
+        for (; part < threads; ++part) {
+            helpers.emplace_back(destroy, part);
+        }
+    } catch (const std::exception&) {
+        // Out of threads or memory: the parts that got no helper run here
+    }
+    for (; part < threads; ++part) {
+        destroy(part);
+    }
+    destroy(0);
+    for (auto& helper : helpers) {
+        helper.join();
+    }
+};
+
+// Wraps a block fresh from one of the factories below, taking over its initial reference
+template <typename T, class Counting>
+SharedPtr<T, Counting> FromFreshBlock(typename SharedPtr<T, Counting>::ElementType* object,
+                                      BasicBlock<Counting>* block) {
+    if constexpr (!std::is_array_v<T>) {
+        LinkSharedFromThis(object, block);
+    }
+    return SharedPtr<T, Counting>(typename SharedPtr<T, Counting>::AdoptBlock{}, object, block);
+};
+
 // Allocate memory only once
 template <typename T, typename... Args>
+requires(!std::is_array_v<T>)
 SharedPtr<T> MakeShared(Args&&... args) {
-    SharedPtr<T> ptr(true, std::forward<Args>(args)...);
+    SharedPtr<T> ptr(std::in_place, std::forward<Args>(args)...);
     return ptr;
 };
 
-// Look for usage examples in tests
+// MakeShared for LocalSharedPtr
+template <typename T, typename... Args>
+requires(!std::is_array_v<T>)
+LocalSharedPtr<T> MakeLocalShared(Args&&... args) {
+    LocalSharedPtr<T> ptr(std::in_place, std::forward<Args>(args)...);
+    return ptr;
+};
+
+// Common part of MakeShared for unbounded and bounded arrays
+template <typename T, typename... Args>
+requires std::is_array_v<T>
+SharedPtr<T> MakeSharedArray(size_t size, const Args&... init) {
+    using Element = std::remove_extent_t<T>;
+    AllocatedArray<Element>* block = AllocatedArray<Element>::Create(size, init...);
+    return FromFreshBlock<T>(block->GetObject(), block);
+};
+
+// `size` elements and the block in one allocation; each element is Element(init...)
+template <typename T, typename... Args>
+requires std::is_unbounded_array_v<T>
+SharedPtr<T> MakeShared(size_t size, const Args&... init) {
+    return MakeSharedArray<T>(size, init...);
+};
+
+template <typename T, typename... Args>
+requires std::is_bounded_array_v<T>
+SharedPtr<T> MakeShared(const Args&... init) {
+    return MakeSharedArray<T>(std::extent_v<T>, init...);
+};
+
+// Like MakeShared, but the object is default-initialized: a trivially constructible payload is
+// left as it is instead of being zeroed, for buffers that are about to be overwritten anyway
 template <typename T>
-class EnableSharedFromThis {
+requires(!std::is_array_v<T>)
+SharedPtr<T> MakeSharedForOverwrite() {
+    auto* block = new AllocatedByOurselves<T>(DefaultInit{});
+    return FromFreshBlock<T>(block->GetObject(), block);
+};
+
+template <typename T>
+requires std::is_unbounded_array_v<T>
+SharedPtr<T> MakeSharedForOverwrite(size_t size) {
+    return MakeSharedArray<T>(size, DefaultInit{});
+};
+
+template <typename T>
+requires std::is_bounded_array_v<T>
+SharedPtr<T> MakeSharedForOverwrite() {
+    return MakeSharedArray<T>(std::extent_v<T>, DefaultInit{});
+};
+
+// Like MakeShared, but the single allocation comes from `alloc`
+template <typename T, typename Alloc, typename... Args>
+SharedPtr<T> AllocateShared(const Alloc& alloc, Args&&... args) {
+    auto* block = NewBlock<AllocatedByAllocator<T, Alloc>>(alloc, std::forward<Args>(args)...);
+    return FromFreshBlock<T>(block->GetObject(), block);
+};
+
+// Look for usage examples in tests. Objects owned by LocalSharedPtr-s derive from
+// EnableSharedFromThis<T, LocalCounting>.
+template <typename T, class Counting>
+class EnableSharedFromThis : public EnableSharedFromThisBase<Counting> {
+    using EnableSharedFromThisBase<Counting>::WeakBlock;
+
 public:
-    SharedPtr<T> SharedFromThis();
-    SharedPtr<const T> SharedFromThis() const;
+    // Throws BadWeakPtr unless the object is owned by a SharedPtr
+    SharedPtr<T, Counting> SharedFromThis() {
+        return Share<T>(static_cast<T*>(this));
+    }
+    SharedPtr<const T, Counting> SharedFromThis() const {
+        return Share<const T>(static_cast<const T*>(this));
+    }
 
-    WeakPtr<T> WeakFromThis() noexcept;
-    WeakPtr<const T> WeakFromThis() const noexcept;
+    // Empty unless the object is owned by a SharedPtr
+    WeakPtr<T, Counting> WeakFromThis() noexcept {
+        return WeakPtr<T, Counting>(static_cast<T*>(this), WeakBlock());
+    }
+    WeakPtr<const T, Counting> WeakFromThis() const noexcept {
+        return WeakPtr<const T, Counting>(static_cast<const T*>(this), WeakBlock());
+    }
+
+protected:
+    EnableSharedFromThis() noexcept = default;
+    EnableSharedFromThis(const EnableSharedFromThis&) noexcept = default;
+    EnableSharedFromThis& operator=(const EnableSharedFromThis&) noexcept = default;
+    ~EnableSharedFromThis() = default;
+
+private:
+    template <typename U>
+    SharedPtr<U, Counting> Share(U* object) const {
+        BasicBlock<Counting>* block = WeakBlock();
+        // Zero while the object is being destroyed or between owners
+        if (block == nullptr || !block->IncCounterIfNonZero()) {
+            throw BadWeakPtr();
+        }
+        return SharedPtr<U, Counting>(typename SharedPtr<U, Counting>::AdoptBlock{}, object,
+                                      block);
+    }
 };
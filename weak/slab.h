@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstddef>
+#include <mutex>
+#include <new>
+
+// Thread-caching slab allocator for control blocks.
+// Sizes up to kMaxSize are rounded up to a multiple of kGranularity; each such size class has
+// a free list per thread and one shared central list. A thread allocates from and frees to its
+// own list without any synchronization. An empty list is refilled with a batch from the central
+// list, and only when that is empty too with a fresh slab from the global heap. A list that grew
+// too long gives a batch back to the central list, as does a thread that exits.
+// Slabs are never returned to the heap.
+class SlabCache {
+public:
+    static constexpr size_t kGranularity = 16;
+    static constexpr size_t kMaxSize = 256;
+    static constexpr size_t kClasses = kMaxSize / kGranularity;
+    // Blocks moved per refill or per trip to the central list
+    static constexpr size_t kBatch = 64;
+    static constexpr size_t kMaxCached = 4 * kBatch;
+
+    static void* Allocate(size_t size) {
+        if (size > kMaxSize) {
+            return ::operator new(size);
+        }
+        size_t cls = ClassOf(size);
+        if (cache.state == kActive && cache.lists[cls].head != nullptr) {
+            return cache.lists[cls].Pop();
+        }
+        return AllocateSlow(cls);
+    }
+
+    static void Deallocate(void* ptr, size_t size) {
+        if (size > kMaxSize) {
+            ::operator delete(ptr, size);
+            return;
+        }
+        size_t cls = ClassOf(size);
+        if (cache.state == kActive && cache.lists[cls].length < kMaxCached) {
+            cache.lists[cls].Push(ptr);
+            return;
+        }
+        DeallocateSlow(cls, ptr);
+    }
+
+    // Free blocks of this size in the calling thread's cache
+    static size_t CachedBlocks(size_t size) {
+        return cache.lists[ClassOf(size)].length;
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct FreeList {
+        void Push(void* ptr) {
+            FreeBlock* block = static_cast<FreeBlock*>(ptr);
+            block->next = head;
+            head = block;
+            ++length;
+        }
+
+        void* Pop() {
+            FreeBlock* block = head;
+            head = block->next;
+            --length;
+            return block;
+        }
+
+        // Moves up to `count` blocks to the front of `to`
+        void MoveTo(FreeList& to, size_t count) {
+            while (count-- > 0 && head != nullptr) {
+                to.Push(Pop());
+            }
+        }
+
+        FreeBlock* head = nullptr;
+        size_t length = 0;
+    };
+
+    enum State { kFresh, kActive, kExited };
+
+    // Trivially destructible, so it needs no guard on access; ExitGuard flushes it
+    struct ThreadCache {
+        FreeList lists[kClasses];
+        State state = kFresh;
+    };
+
+    struct CentralList {
+        std::mutex mutex;
+        FreeList list;
+    };
+
+    struct ExitGuard {
+        ~ExitGuard() {
+            for (size_t cls = 0; cls < kClasses; ++cls) {
+                std::lock_guard lock(central[cls].mutex);
+                cache.lists[cls].MoveTo(central[cls].list, cache.lists[cls].length);
+            }
+            // Blocks released later by this thread's destructors go straight to the central lists
+            cache.state = kExited;
+        }
+    };
+
+    static size_t ClassOf(size_t size) {
+        return (size + kGranularity - 1) / kGranularity - 1;
+    }
+
+    static size_t SizeOf(size_t cls) {
+        return (cls + 1) * kGranularity;
+    }
+
+    static void* AllocateSlow(size_t cls) {
+        if (cache.state == kFresh) {
+            Activate();
+        }
+        std::lock_guard lock(central[cls].mutex);
+        FreeList& shared = central[cls].list;
+        if (shared.head == nullptr) {
+            // The only place that touches the global heap
+            char* slab = static_cast<char*>(::operator new(kBatch * SizeOf(cls)));
+            for (size_t i = kBatch; i-- > 0;) {
+                shared.Push(slab + i * SizeOf(cls));
+            }
+        }
+        if (cache.state == kExited) {
+            return shared.Pop();
+        }
+        shared.MoveTo(cache.lists[cls], kBatch);
+        return cache.lists[cls].Pop();
+    }
+
+    static void DeallocateSlow(size_t cls, void* ptr) {
+        if (cache.state == kFresh) {
+            Activate();
+        }
+        std::lock_guard lock(central[cls].mutex);
+        if (cache.state == kActive) {
+            cache.lists[cls].MoveTo(central[cls].list, kBatch);
+            cache.lists[cls].Push(ptr);
+        } else {
+            central[cls].list.Push(ptr);
+        }
+    }
+
+    static void Activate() {
+        static thread_local ExitGuard exit_guard;
+        cache.state = kActive;
+    }
+
+    static thread_local ThreadCache cache;
+    static CentralList central[kClasses];
+};
+
+// Defined out of the class: the nested types are only complete here
+inline constinit thread_local SlabCache::ThreadCache SlabCache::cache;
+inline SlabCache::CentralList SlabCache::central[SlabCache::kClasses];
@@ -4,8 +4,32 @@
 
 class BadWeakPtr : public std::exception {};
 
-template <typename T>
+// Counting policies, see shared.h: plain counters for objects that never leave their thread,
+// atomic ones, and biased ones that are plain for the creating thread
+struct LocalCounting;
+struct AtomicCounting;
+struct BiasedCounting;
+
+// The policy of SharedPtr<T> and WeakPtr<T>. SHARED_PTR_BIASED_COUNTING and
+// SHARED_PTR_LOCAL_COUNTING switch it for the whole program, which has to agree on the mode.
+#if defined(SHARED_PTR_BIASED_COUNTING) && defined(SHARED_PTR_LOCAL_COUNTING)
+#error "SHARED_PTR_BIASED_COUNTING and SHARED_PTR_LOCAL_COUNTING are exclusive"
+#elif defined(SHARED_PTR_BIASED_COUNTING)
+using DefaultCounting = BiasedCounting;
+#elif defined(SHARED_PTR_LOCAL_COUNTING)
+using DefaultCounting = LocalCounting;
+#else
+using DefaultCounting = AtomicCounting;
+#endif
+
+template <typename T, class Counting = DefaultCounting>
 class SharedPtr;
 
-template <typename T>
+template <typename T, class Counting = DefaultCounting>
 class WeakPtr;
+
+// Pointers for objects that stay on one thread: no atomic instruction on any count
+template <typename T>
+using LocalSharedPtr = SharedPtr<T, LocalCounting>;
+template <typename T>
+using LocalWeakPtr = WeakPtr<T, LocalCounting>;
@@ -30,6 +30,19 @@ TEST_CASE("No unexpected allocations") {
     EXPECT_ZERO_ALLOCATIONS(WeakPtr<int>{sp2});
 }
 
+TEST_CASE("Control block size") {
+#ifndef SHARED_PTR_BIASED_COUNTING
+    // One vptr and two 32-bit counters; SMART_PTR_INSTRUMENTATION is off here and adds nothing
+    static_assert(sizeof(BlockBase) == sizeof(void*) + 2 * sizeof(uint32_t));
+#endif
+    // Followed by the object or the pointer to it
+    static_assert(sizeof(AllocatedByOurselves<int>) <= sizeof(BlockBase) + 8);
+    static_assert(sizeof(AllocatedByUser<int>) <= sizeof(BlockBase) + 8);
+    static_assert(sizeof(AllocatedByOurselves<char>) == sizeof(AllocatedByOurselves<int>));
+    static_assert(sizeof(SharedPtr<int>) == 2 * sizeof(void*));
+    static_assert(sizeof(WeakPtr<int>) == 2 * sizeof(void*));
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
 TEST_CASE("Copy/move WeakPtr") {
@@ -147,6 +160,28 @@ TEST_CASE("Shared from invalid Weak") {
     REQUIRE_THROWS_AS(SharedPtr<int>(w_ptr), BadWeakPtr);
 }
 
+TEST_CASE("Lock and TryLock") {
+    static_assert(noexcept(WeakPtr<int>().Lock()));
+    static_assert(noexcept(WeakPtr<int>().TryLock()));
+
+    WeakPtr<int> empty;
+    REQUIRE(empty.TryLock().Get() == nullptr);
+    REQUIRE_THROWS_AS(SharedPtr<int>(empty), BadWeakPtr);
+
+    auto sp = MakeShared<int>(42);
+    WeakPtr<int> wp(sp);
+    auto locked = wp.TryLock();
+    REQUIRE(*locked == 42);
+    REQUIRE(sp.UseCount() == 2);
+    EXPECT_ZERO_ALLOCATIONS(wp.Lock());
+
+    sp.Reset();
+    locked.Reset();
+    REQUIRE(wp.TryLock().Get() == nullptr);
+    REQUIRE(wp.Lock().UseCount() == 0);
+    REQUIRE(wp.UseCount() == 0);
+}
+
 TEST_CASE("Constness") {
     SharedPtr<int> sp(new int(42));
     WeakPtr<const int> wp(sp);
@@ -175,3 +210,133 @@ TEST_CASE("Lifetimes") {
         delete wp;
     }
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Callback : EnableSharedFromThis<Callback> {
+    static inline int alive = 0;
+
+    Callback() {
+        ++alive;
+    }
+    Callback(const Callback&) : EnableSharedFromThis(), value(0) {
+        ++alive;
+    }
+    Callback& operator=(const Callback&) = default;
+    ~Callback() {
+        --alive;
+    }
+
+    int value = 1;
+};
+
+struct DerivedCallback : Callback {};
+
+TEST_CASE("EnableSharedFromThis") {
+    Callback::alive = 0;
+
+    SECTION("Linked by MakeShared") {
+        auto sp = MakeShared<Callback>();
+        SharedPtr<Callback> self;
+        EXPECT_ZERO_ALLOCATIONS(self = sp->SharedFromThis());
+        REQUIRE(self.Get() == sp.Get());
+        REQUIRE(self.GetBlock() == sp.GetBlock());
+        REQUIRE(sp.UseCount() == 2);
+        // The embedded reference counts as a weak one
+        REQUIRE(sp.GetBlock()->GetCountWeak() == 1);
+    }
+
+    SECTION("Linked by SharedPtr(T*)") {
+        SharedPtr<Callback> sp(new Callback);
+        SharedPtr<Callback> self;
+        EXPECT_ZERO_ALLOCATIONS(self = sp->SharedFromThis());
+        REQUIRE(self.GetBlock() == sp.GetBlock());
+
+        SharedPtr<Callback> reset;
+        reset.Reset(new Callback);
+        REQUIRE(reset->SharedFromThis().GetBlock() == reset.GetBlock());
+    }
+
+    SECTION("Linked through a base") {
+        SharedPtr<Callback> sp = MakeShared<DerivedCallback>();
+        REQUIRE(sp->SharedFromThis().UseCount() == 2);
+    }
+
+    SECTION("Const and weak") {
+        auto sp = MakeShared<Callback>();
+        const Callback& ref = *sp;
+        SharedPtr<const Callback> csp = ref.SharedFromThis();
+        REQUIRE(csp->value == 1);
+
+        WeakPtr<Callback> wp;
+        EXPECT_ZERO_ALLOCATIONS(wp = sp->WeakFromThis());
+        REQUIRE(wp.Lock().Get() == sp.Get());
+        WeakPtr<const Callback> cwp = ref.WeakFromThis();
+        REQUIRE(!cwp.Expired());
+    }
+
+    SECTION("Not owned") {
+        Callback on_stack;
+        REQUIRE_THROWS_AS(on_stack.SharedFromThis(), BadWeakPtr);
+        REQUIRE(on_stack.WeakFromThis().Expired());
+        REQUIRE(on_stack.WeakFromThis().Get() == nullptr);
+    }
+
+    SECTION("Copies are not linked") {
+        auto sp = MakeShared<Callback>();
+        Callback copy = *sp;
+        REQUIRE_THROWS_AS(copy.SharedFromThis(), BadWeakPtr);
+        copy = *sp;
+        REQUIRE_THROWS_AS(copy.SharedFromThis(), BadWeakPtr);
+    }
+
+    SECTION("Object and block are released") {
+        WeakPtr<Callback> wp;
+        {
+            auto sp = MakeShared<Callback>();
+            wp = sp->WeakFromThis();
+            auto self = sp->SharedFromThis();
+        }
+        REQUIRE(wp.Expired());
+        REQUIRE(Callback::alive == 0);
+    }
+
+    SECTION("Relinked when adopted again") {
+        // A pool hands the same object out twice; its deleter keeps it alive
+        Callback pooled;
+        auto keep = [](Callback*) {};
+        WeakPtr<Callback> first_owner;
+        {
+            SharedPtr<Callback> first(&pooled, keep);
+            first_owner = pooled.WeakFromThis();
+            REQUIRE(first->SharedFromThis().GetBlock() == first.GetBlock());
+        }
+        REQUIRE(first_owner.Expired());
+        REQUIRE_THROWS_AS(pooled.SharedFromThis(), BadWeakPtr);
+
+        SharedPtr<Callback> second(&pooled, keep);
+        REQUIRE(pooled.SharedFromThis().GetBlock() == second.GetBlock());
+        REQUIRE(second.UseCount() == 1);
+        // The embedded reference to the first block is dropped, only `first_owner` is left
+        REQUIRE(first_owner.GetBlock()->GetCountWeak() == 1);
+        REQUIRE(second.GetBlock()->GetCountWeak() == 1);
+    }
+}
+
+TEST_CASE("LocalWeakPtr") {
+    LocalWeakPtr<std::string> wp;
+    {
+        auto sp = MakeLocalShared<std::string>("local");
+        wp = sp;
+        REQUIRE(wp.UseCount() == 1);
+        REQUIRE(sp.GetBlock()->GetCountWeak() == 1);
+        LocalSharedPtr<std::string> locked = wp.Lock();
+        REQUIRE(*locked == "local");
+        REQUIRE(sp.UseCount() == 2);
+        LocalSharedPtr<std::string> promoted(wp);
+        REQUIRE(sp.UseCount() == 3);
+    }
+    REQUIRE(wp.Expired());
+    REQUIRE(wp.TryLock().Get() == nullptr);
+    REQUIRE_THROWS_AS(LocalSharedPtr<std::string>(wp), BadWeakPtr);
+}
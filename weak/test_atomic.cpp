@@ -0,0 +1,157 @@
+#include "atomic_shared.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Config {
+    static inline std::atomic<int> alive = 0;
+
+    explicit Config(int version) : version(version), checksum(-version) {
+        ++alive;
+    }
+    ~Config() {
+        --alive;
+    }
+
+    int version;
+    int checksum;
+};
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("AtomicSharedPtr basics") {
+    SECTION("Empty") {
+        AtomicSharedPtr<int> a;
+        REQUIRE(a.Load().Get() == nullptr);
+        REQUIRE(a.IsLockFree());
+    }
+
+    SECTION("Load/Store/Exchange") {
+        auto first = MakeShared<std::string>("first");
+        AtomicSharedPtr<std::string> a(first);
+        REQUIRE(first.UseCount() == 2);
+
+        auto loaded = a.Load();
+        REQUIRE(loaded.Get() == first.Get());
+        REQUIRE(loaded.GetBlock() == first.GetBlock());
+        REQUIRE(first.UseCount() == 3);
+
+        a.Store(MakeShared<std::string>("second"));
+        REQUIRE(first.UseCount() == 2);
+        REQUIRE(*a.Load() == "second");
+
+        auto previous = a.Exchange(nullptr);
+        REQUIRE(*previous == "second");
+        REQUIRE(previous.UseCount() == 1);
+        REQUIRE(a.Load().Get() == nullptr);
+    }
+
+    SECTION("CompareExchange") {
+        auto first = MakeShared<int>(1);
+        auto second = MakeShared<int>(2);
+        AtomicSharedPtr<int> a(first);
+
+        SharedPtr<int> expected = second;
+        REQUIRE(!a.CompareExchange(expected, MakeShared<int>(3)));
+        REQUIRE(expected.Get() == first.Get());
+
+        REQUIRE(a.CompareExchange(expected, second));
+        REQUIRE(a.Load().Get() == second.Get());
+        REQUIRE(first.UseCount() == 2);
+
+        SharedPtr<int> empty;
+        REQUIRE(!a.CompareExchange(empty, first));
+        REQUIRE(empty.Get() == second.Get());
+    }
+
+    SECTION("Objects die with the last reference") {
+        Config::alive = 0;
+        {
+            AtomicSharedPtr<Config> a(MakeShared<Config>(1));
+            auto held = a.Load();
+            a.Store(MakeShared<Config>(2));
+            REQUIRE(Config::alive == 2);
+            held.Reset();
+            REQUIRE(Config::alive == 1);
+        }
+        REQUIRE(Config::alive == 0);
+    }
+}
+
+TEST_CASE("AtomicWeakPtr basics") {
+    auto shared = MakeShared<int>(42);
+    AtomicWeakPtr<int> a{WeakPtr<int>(shared)};
+    REQUIRE(*a.Load().Lock() == 42);
+    REQUIRE(shared.UseCount() == 1);
+
+    WeakPtr<int> expected = a.Load();
+    REQUIRE(a.CompareExchange(expected, WeakPtr<int>()));
+    REQUIRE(a.Load().Expired());
+
+    a.Store(WeakPtr<int>(shared));
+    shared.Reset();
+    REQUIRE(a.Load().Expired());
+}
+
+TEST_CASE("Concurrent readers and writers") {
+    constexpr int kWrites = 20'000;
+    constexpr int kReaders = 4;
+    Config::alive = 0;
+    {
+        AtomicSharedPtr<Config> config(MakeShared<Config>(0));
+        std::atomic<bool> done = false;
+        std::atomic<int> torn_reads = 0;
+        std::atomic<int> version_went_back = 0;
+
+        std::vector<std::thread> readers;
+        for (int i = 0; i < kReaders; ++i) {
+            readers.emplace_back([&] {
+                int last_version = 0;
+                while (!done.load()) {
+                    auto current = config.Load();
+                    if (current->checksum != -current->version) {
+                        ++torn_reads;
+                    }
+                    if (current->version < last_version) {
+                        ++version_went_back;
+                    }
+                    last_version = current->version;
+                }
+            });
+        }
+
+        std::thread incrementer([&] {
+            for (int i = 0; i < kWrites; ++i) {
+                auto current = config.Load();
+                while (!config.CompareExchange(current, MakeShared<Config>(current->version + 1))) {
+                }
+            }
+        });
+        for (int i = 0; i < kWrites; ++i) {
+            auto current = config.Load();
+            while (!config.CompareExchange(current, MakeShared<Config>(current->version + 1))) {
+            }
+        }
+        incrementer.join();
+        done = true;
+        for (auto& reader : readers) {
+            reader.join();
+        }
+
+        REQUIRE(torn_reads == 0);
+        REQUIRE(version_went_back == 0);
+        REQUIRE(config.Load()->version == 2 * kWrites);
+        REQUIRE(Config::alive == 1);
+    }
+    REQUIRE(Config::alive == 0);
+}
@@ -0,0 +1,183 @@
+#include "shared.h"
+#include "weak.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static_assert(std::is_base_of_v<BiasedStrongCounter, BlockBase>,
+              "build this suite with SHARED_PTR_BIASED_COUNTING");
+
+namespace {
+
+// Per-thread state is allocated with the first block a thread creates.
+// Create it for the main thread before the allocation-counting tests run.
+const SharedPtr<int> kWarmUp = MakeShared<int>();
+
+struct Counted {
+    static inline std::atomic<int> alive = 0;
+
+    Counted() {
+        ++alive;
+    }
+    ~Counted() {
+        --alive;
+    }
+};
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Owner thread counts") {
+    Counted::alive = 0;
+    {
+        auto a = MakeShared<Counted>();
+        SharedPtr<Counted> b(new Counted);
+        {
+            std::vector<SharedPtr<Counted>> copies(10, a);
+            REQUIRE(a.UseCount() == 11);
+            copies.assign(3, b);
+            REQUIRE(a.UseCount() == 1);
+            REQUIRE(b.UseCount() == 4);
+        }
+        REQUIRE(b.UseCount() == 1);
+        REQUIRE(Counted::alive == 2);
+    }
+    REQUIRE(Counted::alive == 0);
+}
+
+TEST_CASE("Other threads count") {
+    Counted::alive = 0;
+    auto owned = MakeShared<Counted>();
+    std::thread([&] {
+        SharedPtr<Counted> copy = owned;
+        REQUIRE(owned.UseCount() == 2);
+        WeakPtr<Counted> weak(copy);
+        REQUIRE(weak.Lock().UseCount() == 3);
+    }).join();
+    REQUIRE(owned.UseCount() == 1);
+    owned.Reset();
+    REQUIRE(Counted::alive == 0);
+}
+
+TEST_CASE("Lock from other threads") {
+    Counted::alive = 0;
+    auto owned = MakeShared<Counted>();
+    WeakPtr<Counted> weak(owned);
+    // Before the merge the owner's references keep the object alive
+    std::thread([&] { REQUIRE(weak.TryLock().UseCount() == 2); }).join();
+
+    SharedPtr<Counted> elsewhere;
+    std::thread([&] { elsewhere = weak.Lock(); }).join();
+    // Merged, the other thread's reference holds the whole count
+    owned.Reset();
+    REQUIRE(Counted::alive == 1);
+    std::thread([&] { REQUIRE(weak.Lock().UseCount() == 2); }).join();
+
+    elsewhere.Reset();
+    REQUIRE(Counted::alive == 0);
+    std::thread([&] { REQUIRE(weak.TryLock().Get() == nullptr); }).join();
+    REQUIRE(weak.Lock().Get() == nullptr);
+}
+
+TEST_CASE("Batches on either side of the bias") {
+    Counted::alive = 0;
+    auto owned = MakeShared<Counted>();
+    auto local = owned.ShareN(3);
+    REQUIRE(owned.UseCount() == 4);
+
+    std::vector<SharedPtr<Counted>> remote;
+    std::thread([&] {
+        remote = owned.ShareN(4);
+        REQUIRE(owned.UseCount() == 8);
+        // More than the other threads hold so far: queued for the owner
+        ReleaseN(local.begin(), local.end());
+    }).join();
+    REQUIRE(owned.UseCount() == 5);
+
+    // More than the owner's own count, which runs out on the way and merges
+    local = owned.ShareN(1);
+    remote.push_back(std::move(owned));
+    remote.push_back(std::move(local[0]));
+    ReleaseN(remote.begin(), remote.end());
+    REQUIRE(Counted::alive == 0);
+}
+
+TEST_CASE("Release by another thread is merged by the owner") {
+    Counted::alive = 0;
+    auto owned = MakeShared<Counted>();
+    auto copy = owned;
+    // Takes the atomic counter below zero and queues the block for the owner
+    std::thread([&] { copy.Reset(); }).join();
+    REQUIRE(owned.UseCount() == 1);
+    REQUIRE(Counted::alive == 1);
+
+    owned.Reset();
+    REQUIRE(Counted::alive == 0);
+}
+
+TEST_CASE("Queued blocks are merged on demand") {
+    Counted::alive = 0;
+    auto owned = MakeShared<Counted>();
+    auto copy = owned;
+    auto kept = owned;
+    owned.Reset();
+    std::thread([&] {
+        copy.Reset();
+        kept.Reset();
+    }).join();
+    // Both references were the owner's, so the object is only destroyed once it merges
+    REQUIRE(Counted::alive == 1);
+    MergeBiasedCounters();
+    REQUIRE(Counted::alive == 0);
+}
+
+TEST_CASE("Owner exits before the last release") {
+    Counted::alive = 0;
+    SharedPtr<Counted> survivor;
+    WeakPtr<Counted> observer;
+    std::thread([&] {
+        auto owned = MakeShared<Counted>();
+        survivor = owned;
+        observer = owned;
+    }).join();
+    REQUIRE(Counted::alive == 1);
+    REQUIRE(!observer.Expired());
+
+    survivor.Reset();
+    REQUIRE(Counted::alive == 0);
+    REQUIRE(observer.Expired());
+}
+
+TEST_CASE("Owner and other threads copy concurrently") {
+    constexpr int kIterations = 20'000;
+    constexpr int kThreads = 4;
+    Counted::alive = 0;
+    {
+        auto owned = MakeShared<Counted>();
+        std::vector<SharedPtr<Counted>> escaped(kThreads, owned);
+        std::vector<std::thread> threads;
+        for (int i = 0; i < kThreads; ++i) {
+            threads.emplace_back([&, i] {
+                for (int j = 0; j < kIterations; ++j) {
+                    SharedPtr<Counted> copy = escaped[i];
+                }
+                escaped[i].Reset();
+            });
+        }
+        for (int j = 0; j < kIterations; ++j) {
+            SharedPtr<Counted> copy = owned;
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        MergeBiasedCounters();
+        REQUIRE(owned.UseCount() == 1);
+    }
+    REQUIRE(Counted::alive == 0);
+}
@@ -0,0 +1,165 @@
+#include "shared.h"
+#include "weak.h"
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Session {
+    int id = 0;
+};
+
+struct Buffer {
+    char data[100];
+};
+
+template <typename T>
+std::vector<LiveBlock> LiveBlocksOf() {
+    std::vector<LiveBlock> blocks = TakeLiveBlocks();
+    std::erase_if(blocks, [](const LiveBlock& block) { return block.type != TypeName<T>(); });
+    return blocks;
+}
+
+// Live blocks of `T` created under a BlockSite on `line`, 0 for those created under none
+template <typename T>
+size_t CountAt(uint32_t line) {
+    auto blocks = LiveBlocksOf<T>();
+    return std::count_if(blocks.begin(), blocks.end(),
+                         [line](const LiveBlock& block) { return block.site.line() == line; });
+}
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Blocks are listed while alive") {
+    REQUIRE(LiveBlocksOf<Session>().empty());
+    {
+        auto a = MakeShared<Session>();
+        SharedPtr<Session> b(new Session);
+        auto copy = a;
+        WeakPtr<Session> weak = a;
+
+        auto blocks = LiveBlocksOf<Session>();
+        REQUIRE(blocks.size() == 2);
+        std::sort(blocks.begin(), blocks.end(),
+                  [](const LiveBlock& x, const LiveBlock& y) { return x.strong > y.strong; });
+        REQUIRE(blocks[0].strong == 2);
+        REQUIRE(blocks[0].weak == 1);
+        REQUIRE(blocks[0].bytes == sizeof(AllocatedByOurselves<Session>));
+        REQUIRE(blocks[1].strong == 1);
+        REQUIRE(blocks[1].weak == 0);
+        REQUIRE(blocks[1].bytes == sizeof(AllocatedByUser<Session>));
+        REQUIRE(!blocks[0].WeakOnly());
+    }
+    REQUIRE(LiveBlocksOf<Session>().empty());
+}
+
+TEST_CASE("Blocks kept only by weak references") {
+    auto sp = MakeShared<Session>();
+    WeakPtr<Session> weak = sp;
+    sp.Reset();
+
+    auto blocks = LiveBlocksOf<Session>();
+    REQUIRE(blocks.size() == 1);
+    REQUIRE(blocks[0].WeakOnly());
+    REQUIRE(blocks[0].weak == 1);
+
+    weak.Reset();
+    REQUIRE(LiveBlocksOf<Session>().empty());
+}
+
+TEST_CASE("Creation sites") {
+    auto unknown = MakeShared<Session>();
+    BlockSite site;
+    const uint32_t line = __LINE__ - 1;
+    auto known = MakeShared<Session>();
+    {
+        BlockSite inner;
+        const uint32_t inner_line = __LINE__ - 1;
+        auto nested = MakeShared<Session>();
+        REQUIRE(CountAt<Session>(inner_line) == 1);
+        REQUIRE(CountAt<Session>(line) == 1);
+    }
+    REQUIRE(CountAt<Session>(line) == 1);
+    REQUIRE(CountAt<Session>(0) == 1);
+    REQUIRE(SiteName(std::source_location()) == "?");
+}
+
+TEST_CASE("Arrays report the whole allocation") {
+    auto array = MakeShared<Buffer[]>(10);
+    auto blocks = LiveBlocksOf<Buffer>();
+    REQUIRE(blocks.size() == 1);
+    REQUIRE(blocks[0].bytes >= 10 * sizeof(Buffer));
+}
+
+TEST_CASE("Populations diff") {
+    BlockSite site;
+    BlockPopulations before = Populations(TakeLiveBlocks());
+
+    std::vector<SharedPtr<Buffer>> buffers;
+    std::vector<WeakPtr<Buffer>> observers;
+    for (int i = 0; i < 5; ++i) {
+        buffers.push_back(MakeShared<Buffer>());
+        observers.push_back(buffers.back());
+    }
+    buffers.resize(3);
+
+    BlockPopulations diff = Populations(TakeLiveBlocks()) - before;
+    REQUIRE(diff.size() == 1);
+    const auto& [key, population] = *diff.begin();
+    REQUIRE(key.starts_with(std::string(TypeName<Buffer>()) + " @ "));
+    REQUIRE(key.find("test_block_registry.cpp:") != std::string::npos);
+    REQUIRE(population.blocks == 5);
+    REQUIRE(population.bytes == 5 * static_cast<int64_t>(sizeof(AllocatedByOurselves<Buffer>)));
+    REQUIRE(population.weak_only == 2);
+
+    std::ostringstream out;
+    out << diff;
+    REQUIRE(out.str() == "5 " + std::to_string(population.bytes) + " 2 " + key + "\n");
+
+    observers.clear();
+    buffers.clear();
+    REQUIRE((Populations(TakeLiveBlocks()) - before).empty());
+}
+
+TEST_CASE("Local blocks are listed only on their own thread") {
+    auto mine = MakeLocalShared<Buffer>();
+    std::vector<LiveBlock> seen_by_other;
+    std::thread([&seen_by_other] { seen_by_other = LiveBlocksOf<Buffer>(); }).join();
+    REQUIRE(seen_by_other.empty());
+
+    auto blocks = LiveBlocksOf<Buffer>();
+    REQUIRE(blocks.size() == 1);
+    REQUIRE(blocks[0].strong == 1);
+}
+
+TEST_CASE("Concurrent registration") {
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([] {
+            std::vector<SharedPtr<Session>> live;
+            for (int i = 0; i < 10000; ++i) {
+                live.push_back(MakeShared<Session>());
+                if (live.size() > 100) {
+                    live.clear();
+                }
+                if (i % 1000 == 0) {
+                    TakeLiveBlocks();
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(LiveBlocksOf<Session>().empty());
+}
@@ -0,0 +1,157 @@
+#include "shared.h"
+#include "weak.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <optional>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+using Hazards = HazardPointers<BlockBase>;
+
+struct Record {
+    static inline std::atomic<int> alive = 0;
+
+    explicit Record(int key) : key(key), checksum(~key) {
+        ++alive;
+    }
+    ~Record() {
+        checksum = 0;
+        --alive;
+    }
+
+    bool Valid() const {
+        return checksum == ~key;
+    }
+
+    int key;
+    int checksum;
+};
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("HazardGuard reads without touching the counters") {
+    auto sp = MakeShared<Record>(7);
+    WeakPtr<Record> weak = sp;
+    {
+        HazardGuard guard(weak);
+        REQUIRE(guard);
+        REQUIRE(guard->key == 7);
+        REQUIRE(&*guard == sp.Get());
+        REQUIRE(sp.UseCount() == 1);
+        REQUIRE(sp.GetBlock()->GetCountWeak() == 1);
+    }
+
+    REQUIRE(!HazardGuard(WeakPtr<Record>()));
+    sp.Reset();
+    REQUIRE(!HazardGuard(weak));
+    REQUIRE(Hazards::Retired() == 0);
+}
+
+TEST_CASE("A final release under a guard is deferred") {
+    SharedPtr<Record> sp(new Record(1));
+    auto inline_block = MakeShared<Record>(2);
+    WeakPtr<Record> weak = sp;
+    WeakPtr<Record> inline_weak = inline_block;
+    {
+        HazardGuard guard(weak);
+        HazardGuard inline_guard(inline_weak);
+        sp.Reset();
+        inline_block.Reset();
+        REQUIRE(weak.Expired());
+        REQUIRE(weak.Lock().Get() == nullptr);
+        REQUIRE(Record::alive == 2);
+        REQUIRE(Hazards::Retired() == 2);
+        REQUIRE(guard->Valid());
+        REQUIRE(inline_guard->Valid());
+        // Both still protected
+        REQUIRE(Hazards::Reclaim() == 0);
+    }
+    REQUIRE(Record::alive == 0);
+    REQUIRE(Hazards::Retired() == 0);
+}
+
+TEST_CASE("Guards beyond the thread's slots hold a strong reference") {
+    auto sp = MakeShared<Record>(3);
+    WeakPtr<Record> weak = sp;
+    std::vector<std::optional<HazardGuard<Record>>> guards(Hazards::kSlots + 1);
+    for (auto& guard : guards) {
+        guard.emplace(weak);
+        REQUIRE(guard->Get() == sp.Get());
+    }
+    REQUIRE(sp.UseCount() == 2);
+    guards.back().reset();
+    REQUIRE(sp.UseCount() == 1);
+    // A freed slot is reused
+    guards[0].reset();
+    guards[0].emplace(weak);
+    REQUIRE(sp.UseCount() == 1);
+}
+
+TEST_CASE("Readers race the release of the last owner") {
+    constexpr int kRounds = 2000;
+    constexpr int kReaders = 3;
+    std::atomic<int> invalid = 0;
+    for (int round = 0; round < kRounds; ++round) {
+        SharedPtr<Record> owner = round % 2 == 0 ? MakeShared<Record>(round)
+                                                 : SharedPtr<Record>(new Record(round));
+        WeakPtr<Record> weak = owner;
+        std::atomic<bool> start = false;
+        std::vector<std::thread> readers;
+        for (int r = 0; r < kReaders; ++r) {
+            readers.emplace_back([&] {
+                while (!start.load()) {
+                }
+                for (int i = 0; i < 20; ++i) {
+                    HazardGuard guard(weak);
+                    if (guard && !guard->Valid()) {
+                        ++invalid;
+                    }
+                }
+            });
+        }
+        start = true;
+        owner.Reset();
+        for (auto& reader : readers) {
+            reader.join();
+        }
+    }
+    REQUIRE(invalid == 0);
+    // Whoever finished last, the releaser or a reader, freed the object
+    REQUIRE(Record::alive == 0);
+    REQUIRE(Hazards::Retired() == 0);
+}
+
+TEST_CASE("A retired block is freed by the guard that leaves last") {
+    auto sp = MakeShared<Record>(4);
+    WeakPtr<Record> weak = sp;
+    std::atomic<bool> guarded = false;
+    std::atomic<bool> released = false;
+    bool valid = false;
+    std::thread reader([&] {
+        HazardGuard guard(weak);
+        guarded = true;
+        while (!released) {
+            std::this_thread::yield();
+        }
+        valid = guard->Valid();
+    });
+    while (!guarded) {
+        std::this_thread::yield();
+    }
+    sp.Reset();
+    REQUIRE(Hazards::Retired() == 1);
+    REQUIRE(Record::alive == 1);
+    released = true;
+    reader.join();
+    REQUIRE(valid);
+    REQUIRE(Hazards::Retired() == 0);
+    REQUIRE(Record::alive == 0);
+}
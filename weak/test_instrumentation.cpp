@@ -0,0 +1,172 @@
+#include "shared.h"
+#include "weak.h"
+
+#include <intrusive/intrusive.h>
+#include <unique/unique.h>
+
+#include <catch.hpp>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Every test case counts its own type, so the order of the cases does not matter
+
+struct Plain {
+    int value = 0;
+};
+
+struct Adopted {
+    int value = 0;
+};
+
+struct Observed {
+    int value = 0;
+};
+
+struct Threaded {
+    int value = 0;
+};
+
+struct Node : SimpleRefCounted<Node> {
+    int value = 0;
+};
+
+struct Owned {
+    int value = 0;
+};
+
+// What happened to `T` while `f` ran
+template <typename T, typename F>
+RefCountStats StatsOf(F f) {
+    RefCountSnapshot before = TakeRefCountSnapshot();
+    f();
+    RefCountSnapshot diff = TakeRefCountSnapshot() - before;
+    auto it = diff.find(std::string(RefCountRegistry::NameOf<T>()));
+    return it == diff.end() ? RefCountStats{} : it->second;
+}
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Types are named") {
+    REQUIRE(RefCountRegistry::NameOf<int>() == "int");
+    REQUIRE(RefCountRegistry::NameOf<Plain>().ends_with("Plain"));
+    REQUIRE(RefCountRegistry::NameOf<Plain>() != RefCountRegistry::NameOf<Adopted>());
+}
+
+TEST_CASE("SharedPtr") {
+    SECTION("MakeShared") {
+        auto stats = StatsOf<Plain>([] {
+            auto a = MakeShared<Plain>();
+            auto b = a;
+            auto c = std::move(b);
+        });
+        REQUIRE(stats.allocations == 1);
+        REQUIRE(stats.strong_increments == 1);
+        // `a` and `c`; the moved-from `b` has nothing to release
+        REQUIRE(stats.strong_decrements == 2);
+        REQUIRE(stats.destructions == 1);
+        // The strong owners' reference, dropped with the last of them
+        REQUIRE(stats.weak_increments == 0);
+        REQUIRE(stats.weak_decrements == 1);
+    }
+
+    SECTION("From a pointer") {
+        auto stats = StatsOf<Adopted>([] {
+            SharedPtr<Adopted> a(new Adopted);
+            a.Reset(new Adopted);
+        });
+        REQUIRE(stats.allocations == 2);
+        REQUIRE(stats.destructions == 2);
+        REQUIRE(stats.strong_increments == 0);
+        REQUIRE(stats.strong_decrements == 2);
+    }
+}
+
+TEST_CASE("WeakPtr") {
+    auto stats = StatsOf<Observed>([] {
+        auto sp = MakeShared<Observed>();
+        WeakPtr<Observed> wp = sp;
+        WeakPtr<Observed> copy = wp;
+        REQUIRE(wp.Lock().Get() != nullptr);
+        SharedPtr<Observed> promoted(copy);
+        sp.Reset();
+        promoted.Reset();
+        REQUIRE(wp.Lock().Get() == nullptr);
+    });
+    REQUIRE(stats.allocations == 1);
+    REQUIRE(stats.weak_increments == 2);
+    REQUIRE(stats.weak_decrements == 3);
+    REQUIRE(stats.promotions == 2);
+    REQUIRE(stats.strong_increments == 2);
+    REQUIRE(stats.strong_decrements == 3);
+    REQUIRE(stats.destructions == 1);
+}
+
+TEST_CASE("Threads are merged") {
+    constexpr int kThreads = 4;
+    constexpr int kCopies = 1000;
+    auto stats = StatsOf<Threaded>([] {
+        auto sp = MakeShared<Threaded>();
+        std::vector<std::thread> threads;
+        for (int t = 0; t < kThreads; ++t) {
+            threads.emplace_back([sp] {
+                for (int i = 0; i < kCopies; ++i) {
+                    SharedPtr<Threaded> copy = sp;
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    });
+    // The lambda copies and the copies inside the threads
+    REQUIRE(stats.strong_increments == kThreads * (kCopies + 1));
+    REQUIRE(stats.strong_decrements == kThreads * (kCopies + 1) + 1);
+    REQUIRE(stats.destructions == 1);
+}
+
+TEST_CASE("IntrusivePtr") {
+    auto stats = StatsOf<Node>([] {
+        auto a = MakeIntrusive<Node>();
+        IntrusivePtr<Node> b = a;
+    });
+    REQUIRE(stats.allocations == 1);
+    REQUIRE(stats.strong_increments == 2);
+    REQUIRE(stats.strong_decrements == 2);
+    REQUIRE(stats.destructions == 1);
+}
+
+TEST_CASE("UniquePtr") {
+    auto stats = StatsOf<Owned>([] {
+        UniquePtr<Owned> a(new Owned);
+        UniquePtr<Owned> b = std::move(a);
+        b.Reset(new Owned);
+        UniquePtr<Owned> empty;
+    });
+    REQUIRE(stats.allocations == 2);
+    REQUIRE(stats.destructions == 2);
+    REQUIRE(stats.CounterOps() == 0);
+}
+
+TEST_CASE("Snapshots subtract") {
+    RefCountSnapshot before = TakeRefCountSnapshot();
+    REQUIRE((TakeRefCountSnapshot() - before).empty());
+}
+
+TEST_CASE("Recording never throws") {
+    STATIC_REQUIRE(noexcept(RefCountRegistry::Record(0, RefEvent::kAllocation)));
+    STATIC_REQUIRE(noexcept(RefCountRegistry::SlotOf<Plain>()));
+    // Types past kMaxSlots land in the shared slot
+    RefCountSnapshot before = TakeRefCountSnapshot();
+    RefCountRegistry::Record(RefCountRegistry::kOtherSlot, RefEvent::kAllocation);
+    RefCountSnapshot diff = TakeRefCountSnapshot() - before;
+    REQUIRE(diff.size() == 1);
+    REQUIRE(diff[std::string(RefCountRegistry::kOtherName)].allocations == 1);
+}
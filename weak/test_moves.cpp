@@ -0,0 +1,176 @@
+#include "shared.h"
+#include "weak.h"
+
+#include <catch.hpp>
+
+#include <iterator>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Counter updates made by `f`
+template <typename F>
+size_t BlockOps(F f) {
+    RefCountSnapshot before = TakeRefCountSnapshot();
+    f();
+    size_t ops = 0;
+    for (const auto& [type, stats] : TakeRefCountSnapshot() - before) {
+        ops += stats.CounterOps();
+    }
+    return ops;
+}
+
+struct Base {
+    virtual ~Base() = default;
+};
+
+struct Derived : Base {};
+
+}  // namespace
+
+static_assert(std::is_nothrow_move_constructible_v<SharedPtr<int>>);
+static_assert(std::is_nothrow_move_assignable_v<SharedPtr<int>>);
+static_assert(std::is_nothrow_constructible_v<SharedPtr<Base>, SharedPtr<Derived>&&>);
+static_assert(std::is_nothrow_assignable_v<SharedPtr<Base>&, SharedPtr<Derived>&&>);
+static_assert(std::is_nothrow_move_constructible_v<WeakPtr<int>>);
+static_assert(std::is_nothrow_move_assignable_v<WeakPtr<int>>);
+static_assert(std::is_nothrow_swappable_v<SharedPtr<int>>);
+static_assert(std::is_nothrow_swappable_v<WeakPtr<int>>);
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Counting works") {
+    auto sp = MakeShared<int>(1);
+    REQUIRE(BlockOps([&] { SharedPtr<int> copy = sp; }) == 2);
+    REQUIRE(BlockOps([&] { WeakPtr<int> weak = sp; }) == 2);
+}
+
+TEST_CASE("SharedPtr moves touch no counters") {
+    auto sp = MakeShared<int>(1);
+
+    SECTION("Move constructor") {
+        REQUIRE(BlockOps([&] { SharedPtr<int> moved(std::move(sp)); sp = std::move(moved); }) == 0);
+        REQUIRE(sp.UseCount() == 1);
+    }
+
+    SECTION("Move assignment into an empty pointer") {
+        SharedPtr<int> target;
+        REQUIRE(BlockOps([&] { target = std::move(sp); }) == 0);
+        REQUIRE(sp.Get() == nullptr);
+        REQUIRE(sp.GetBlock() == nullptr);
+        REQUIRE(target.UseCount() == 1);
+    }
+
+    SECTION("Move assignment releases only the old value") {
+        auto target = MakeShared<int>(2);
+        SharedPtr<int> keep = target;
+        REQUIRE(BlockOps([&] { target = std::move(sp); }) == 1);
+        REQUIRE(*target == 1);
+        REQUIRE(keep.UseCount() == 1);
+    }
+
+    SECTION("Self-move") {
+        SharedPtr<int>& alias = sp;
+        REQUIRE(BlockOps([&] { sp = std::move(alias); }) == 0);
+        REQUIRE(*sp == 1);
+        REQUIRE(sp.UseCount() == 1);
+    }
+
+    SECTION("Converting moves") {
+        SharedPtr<Derived> derived = MakeShared<Derived>();
+        SharedPtr<Base> base;
+        REQUIRE(BlockOps([&] {
+                    SharedPtr<Base> moved(std::move(derived));
+                    base = std::move(moved);
+                }) == 0);
+        REQUIRE(derived.GetBlock() == nullptr);
+        REQUIRE(base.UseCount() == 1);
+    }
+
+    SECTION("Vector reallocation moves") {
+        std::vector<SharedPtr<int>> pointers(100, sp);
+        REQUIRE(BlockOps([&] { pointers.reserve(pointers.capacity() * 4); }) == 0);
+        REQUIRE(sp.UseCount() == 101);
+    }
+}
+
+TEST_CASE("WeakPtr moves touch no counters") {
+    auto sp = MakeShared<int>(1);
+    WeakPtr<int> wp = sp;
+
+    SECTION("Move constructor") {
+        REQUIRE(BlockOps([&] { WeakPtr<int> moved(std::move(wp)); wp = std::move(moved); }) == 0);
+        REQUIRE(sp.GetBlock()->GetCountWeak() == 1);
+    }
+
+    SECTION("Move assignment") {
+        WeakPtr<int> target;
+        REQUIRE(BlockOps([&] { target = std::move(wp); }) == 0);
+        REQUIRE(wp.GetBlock() == nullptr);
+        REQUIRE(wp.Expired());
+        REQUIRE(target.Lock().Get() == sp.Get());
+    }
+
+    SECTION("Self-move") {
+        WeakPtr<int>& alias = wp;
+        REQUIRE(BlockOps([&] { wp = std::move(alias); }) == 0);
+        REQUIRE(!wp.Expired());
+    }
+
+    SECTION("Vector reallocation moves") {
+        std::vector<WeakPtr<int>> pointers(100, wp);
+        REQUIRE(BlockOps([&] { pointers.reserve(pointers.capacity() * 4); }) == 0);
+    }
+}
+
+TEST_CASE("Projections and casts of rvalues touch no counters") {
+    struct Pair {
+        int first = 1;
+        int second = 2;
+    };
+    auto pair = MakeShared<Pair>();
+    auto copy = [&pair] { return pair; };
+
+    // The copy and the release of the projection; the temporary hands its reference over
+    REQUIRE(BlockOps([&] { SharedPtr<int> second(copy(), &pair->second); }) == 2);
+    REQUIRE(BlockOps([&] { SharedPtr<int> second(pair, &pair->second); }) == 2);
+
+    SharedPtr<Base> base = MakeShared<Derived>();
+    REQUIRE(BlockOps([&] {
+                SharedPtr<Base> moved = std::move(base);
+                auto derived = StaticPointerCast<Derived>(std::move(moved));
+                auto upcast = StaticPointerCast<Base>(std::move(derived));
+                auto again = DynamicPointerCast<Derived>(std::move(upcast));
+                auto constant = ConstPointerCast<const Derived>(std::move(again));
+                base = ReinterpretPointerCast<Base>(ConstPointerCast<Derived>(std::move(constant)));
+            }) == 0);
+    REQUIRE(base.UseCount() == 1);
+    REQUIRE(BlockOps([&] { auto derived = StaticPointerCast<Derived>(base); }) == 2);
+}
+
+TEST_CASE("Batches make one counter update") {
+    auto sp = MakeShared<int>(1);
+    std::vector<SharedPtr<int>> batch;
+    batch.reserve(64);
+    REQUIRE(BlockOps([&] { sp.ShareN(64, std::back_inserter(batch)); }) == 1);
+    REQUIRE(sp.UseCount() == 65);
+    REQUIRE(BlockOps([&] { ReleaseN(batch.begin(), batch.end()); }) == 1);
+    REQUIRE(sp.UseCount() == 1);
+}
+
+TEST_CASE("ReleaseAll makes one counter update per block") {
+    auto a = MakeShared<int>(1);
+    auto b = MakeShared<int>(2);
+    std::vector<SharedPtr<int>> ids;
+    for (int i = 0; i < 50; ++i) {
+        ids.push_back(a);
+        ids.push_back(b);
+    }
+    REQUIRE(BlockOps([&] { ReleaseAll(ids.begin(), ids.end()); }) == 2);
+    REQUIRE(a.UseCount() == 1);
+    REQUIRE(b.UseCount() == 1);
+}
@@ -0,0 +1,220 @@
+#include "shared.h"
+#include "weak.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+using Reclaimer = EpochReclaimer<BlockBase>;
+
+struct Heavy {
+    static inline std::atomic<int> alive = 0;
+
+    Heavy() {
+        ++alive;
+    }
+    ~Heavy() {
+        --alive;
+    }
+
+    SharedPtr<Heavy> child;
+};
+
+// Makes operator new on this thread throw
+thread_local bool out_of_memory = false;
+
+}  // namespace
+
+void* operator new(size_t size) {
+    if (out_of_memory) {
+        throw std::bad_alloc();
+    }
+    if (void* ptr = std::malloc(size == 0 ? 1 : size)) {
+        return ptr;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept {
+    std::free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+    std::free(ptr);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Releases outside a DeferReleases scope destroy inline") {
+    Reclaimer::Advance();
+    auto sp = MakeShared<Heavy>();
+    sp.Reset();
+    REQUIRE(Heavy::alive == 0);
+    REQUIRE(Reclaimer::RetiredOnThisThread() == 0);
+    REQUIRE(Reclaimer::Pending() == 0);
+}
+
+TEST_CASE("Deferred releases") {
+    Reclaimer::Advance();
+    auto a = MakeShared<Heavy>();
+    SharedPtr<Heavy> b(new Heavy);
+    WeakPtr<Heavy> weak = a;
+    {
+        DeferReleases defer;
+        REQUIRE(DeferReleases::Active());
+        a.Reset();
+        b.Reset();
+        REQUIRE(Heavy::alive == 2);
+        REQUIRE(Reclaimer::RetiredOnThisThread() == 2);
+        REQUIRE(weak.Expired());
+        REQUIRE(weak.Lock().Get() == nullptr);
+        {
+            DeferReleases nested;
+        }
+        REQUIRE(Reclaimer::RetiredOnThisThread() == 2);
+    }
+    REQUIRE(!DeferReleases::Active());
+    // The outermost scope hands the list off
+    REQUIRE(Reclaimer::RetiredOnThisThread() == 0);
+    REQUIRE(Reclaimer::Pending() == 2);
+    REQUIRE(Heavy::alive == 2);
+
+    REQUIRE(Reclaimer::Advance() == 2);
+    REQUIRE(Heavy::alive == 0);
+    REQUIRE(weak.Expired());
+}
+
+TEST_CASE("Retire lists are handed off on an epoch change and when full") {
+    Reclaimer::Advance();
+    DeferReleases defer;
+
+    MakeShared<Heavy>();
+    REQUIRE(Reclaimer::RetiredOnThisThread() == 1);
+    uint64_t epoch = Reclaimer::Epoch();
+    REQUIRE(Reclaimer::Advance() == 0);
+    REQUIRE(Reclaimer::Epoch() == epoch + 1);
+    // The first release of the new epoch hands the older blocks off
+    MakeShared<Heavy>();
+    REQUIRE(Reclaimer::RetiredOnThisThread() == 1);
+    REQUIRE(Reclaimer::Pending() == 1);
+    REQUIRE(Reclaimer::Advance() == 1);
+    REQUIRE(Heavy::alive == 1);
+
+    // Hands off the block left from the previous epoch
+    MakeShared<Heavy>();
+    REQUIRE(Reclaimer::RetiredOnThisThread() == 1);
+    REQUIRE(Reclaimer::Pending() == 1);
+    for (size_t i = 2; i < Reclaimer::kBatch; ++i) {
+        MakeShared<Heavy>();
+    }
+    REQUIRE(Reclaimer::RetiredOnThisThread() == Reclaimer::kBatch - 1);
+    MakeShared<Heavy>();
+    REQUIRE(Reclaimer::RetiredOnThisThread() == 0);
+    REQUIRE(Reclaimer::Advance() == Reclaimer::kBatch + 1);
+    REQUIRE(Heavy::alive == 0);
+}
+
+TEST_CASE("Releases that cannot be queued destroy inline") {
+    Reclaimer::Advance();
+    std::vector<SharedPtr<Heavy>> objects;
+    for (size_t i = 0; i < Reclaimer::kBatch + 1; ++i) {
+        objects.push_back(MakeShared<Heavy>());
+    }
+    {
+        DeferReleases defer;
+        out_of_memory = true;
+        // The list fills up and cannot be handed off, so the last release finds no room
+        for (auto& object : objects) {
+            object.Reset();
+        }
+        out_of_memory = false;
+        REQUIRE(Reclaimer::RetiredOnThisThread() == Reclaimer::kBatch);
+        REQUIRE(Heavy::alive == static_cast<int>(Reclaimer::kBatch));
+    }
+    REQUIRE(Reclaimer::Advance() == Reclaimer::kBatch);
+    REQUIRE(Heavy::alive == 0);
+}
+
+TEST_CASE("Objects released by deferred destructors are deferred too") {
+    Reclaimer::Advance();
+    {
+        DeferReleases defer;
+        auto parent = MakeShared<Heavy>();
+        parent->child = MakeShared<Heavy>();
+        parent->child->child = MakeShared<Heavy>();
+        parent.Reset();
+        Reclaimer::Flush();
+        REQUIRE(Heavy::alive == 3);
+
+        // One level per epoch
+        REQUIRE(Reclaimer::Advance() == 1);
+        REQUIRE(Heavy::alive == 2);
+        Reclaimer::Flush();
+        REQUIRE(Reclaimer::Advance() == 1);
+        REQUIRE(Heavy::alive == 1);
+    }
+    REQUIRE(Reclaimer::Advance() == 1);
+    REQUIRE(Heavy::alive == 0);
+}
+
+TEST_CASE("Blocks of a thread that goes quiet inside its scope are reclaimed") {
+    Reclaimer::Advance();
+    std::atomic<bool> retired = false;
+    std::atomic<bool> done = false;
+    std::thread idle([&] {
+        DeferReleases defer;
+        MakeShared<Heavy>();
+        retired = true;
+        while (!done) {
+            std::this_thread::yield();
+        }
+    });
+    while (!retired) {
+        std::this_thread::yield();
+    }
+    REQUIRE(Heavy::alive == 1);
+    // The block was retired in the epoch the first Advance ends; the second one takes it
+    REQUIRE(Reclaimer::Advance() == 0);
+    REQUIRE(Reclaimer::Advance() == 1);
+    REQUIRE(Heavy::alive == 0);
+    done = true;
+    idle.join();
+    REQUIRE(Reclaimer::Pending() == 0);
+}
+
+TEST_CASE("Background reclaimer") {
+    Reclaimer::Start(std::chrono::milliseconds(1));
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([] {
+            DeferReleases defer;
+            auto shared = MakeShared<Heavy>();
+            for (int i = 0; i < 20000; ++i) {
+                auto fresh = MakeShared<Heavy>();
+                fresh->child = shared;
+                if (i % 100 == 0) {
+                    shared = fresh;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (Heavy::alive > 0 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    Reclaimer::Stop();
+    REQUIRE(Heavy::alive == 0);
+    REQUIRE(Reclaimer::Pending() == 0);
+}
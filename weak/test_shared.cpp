@@ -4,7 +4,12 @@
 
 #include "allocations_checker.h"
 
+#include <array>
+#include <cstdint>
 #include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////
 
@@ -354,6 +359,131 @@ TEST_CASE("MakeShared") {
     }
 }
 
+// Bump arena that counts what went through it; copies and rebinds share it
+struct AllocationStats {
+    alignas(std::max_align_t) char buffer[1024];
+    size_t bytes = 0;
+    int allocations = 0;
+    int deallocations = 0;
+};
+
+template <typename T>
+struct CountingAllocator {
+    using value_type = T;
+
+    explicit CountingAllocator(AllocationStats* stats) : stats(stats) {
+    }
+
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U>& other) : stats(other.stats) {
+    }
+
+    T* allocate(size_t n) {
+        size_t offset = (stats->bytes + alignof(std::max_align_t) - 1) &
+                        ~(alignof(std::max_align_t) - 1);
+        ++stats->allocations;
+        stats->bytes = offset + n * sizeof(T);
+        REQUIRE(stats->bytes <= sizeof(stats->buffer));
+        return reinterpret_cast<T*>(stats->buffer + offset);
+    }
+
+    void deallocate(T*, size_t) {
+        ++stats->deallocations;
+    }
+
+    template <typename U>
+    bool operator==(const CountingAllocator<U>& other) const {
+        return stats == other.stats;
+    }
+
+    AllocationStats* stats;
+};
+
+template <typename T>
+struct ThrowingAllocator {
+    using value_type = T;
+
+    ThrowingAllocator() = default;
+
+    template <typename U>
+    ThrowingAllocator(const ThrowingAllocator<U>&) {
+    }
+
+    T* allocate(size_t) {
+        throw std::bad_alloc();
+    }
+
+    void deallocate(T*, size_t) {
+    }
+};
+
+TEST_CASE("AllocateShared") {
+    AllocationStats stats;
+    CountingAllocator<char> alloc(&stats);
+
+    SECTION("Single allocation from the allocator") {
+        {
+            SharedPtr<int> sp;
+            EXPECT_ZERO_ALLOCATIONS(sp = AllocateShared<int>(alloc, 42));
+            REQUIRE(*sp == 42);
+            REQUIRE(stats.allocations == 1);
+            REQUIRE(stats.bytes >= sizeof(int));
+            REQUIRE(stats.deallocations == 0);
+        }
+        REQUIRE(stats.deallocations == 1);
+    }
+
+    SECTION("Parameters passing") {
+        auto p_int = std::make_unique<int>(42);
+        Pinned pinned(1312);
+        auto p = AllocateShared<D>(alloc, pinned, std::move(p_int));
+
+        REQUIRE(p->GetUP() == 42);
+        REQUIRE(p->GetPinned().GetTag() == 1312);
+    }
+
+    SECTION("Faulty constructor") {
+        REQUIRE_THROWS(AllocateShared<Throwing>(alloc));
+        REQUIRE(stats.allocations == 1);
+        REQUIRE(stats.deallocations == 1);
+    }
+
+    SECTION("Const object") {
+        SharedPtr<const int> sp = AllocateShared<const int>(alloc, 7);
+        REQUIRE(*sp == 7);
+    }
+}
+
+TEST_CASE("Deleter and allocator") {
+    AllocationStats stats;
+    CountingAllocator<int> alloc(&stats);
+    int deleted = 0;
+    auto deleter = [&deleted](int* ptr) {
+        ++deleted;
+        delete ptr;
+    };
+
+    SECTION("Block comes from the allocator") {
+        int* raw = new int(5);
+        {
+            SharedPtr<int> sp;
+            EXPECT_ZERO_ALLOCATIONS(sp = SharedPtr<int>(raw, deleter, alloc));
+            REQUIRE(sp.Get() == raw);
+            SharedPtr<int> copy = sp;
+            REQUIRE(copy.UseCount() == 2);
+        }
+        REQUIRE(deleted == 1);
+        REQUIRE(stats.allocations == 1);
+        REQUIRE(stats.deallocations == 1);
+    }
+
+    SECTION("Deleter runs when the allocator throws") {
+        REQUIRE_THROWS_AS(SharedPtr<int>(new int(5), deleter, ThrowingAllocator<int>()),
+                          std::bad_alloc);
+        REQUIRE(deleted == 1);
+    }
+}
+
 struct Data {
     static bool data_was_deleted;
 
@@ -390,6 +520,24 @@ TEST_CASE("Aliasing constructor") {
         }
         REQUIRE(Data::data_was_deleted);
     }
+
+    SECTION("From an rvalue") {
+        Data::data_was_deleted = false;
+        {
+            SharedPtr<Data> sp(new Data{42, 3.14});
+            SharedPtr<int> x(std::move(sp), &sp->x);
+            REQUIRE(*x == 42);
+            REQUIRE(x.UseCount() == 1);
+            REQUIRE(sp.Get() == nullptr);
+            REQUIRE(sp.GetBlock() == nullptr);
+
+            auto make = [] { return MakeShared<Data>(Data{7, 2.5}); };
+            SharedPtr<double> y(make(), nullptr);
+            REQUIRE(y.Get() == nullptr);
+            REQUIRE(y.UseCount() == 1);
+        }
+        REQUIRE(Data::data_was_deleted);
+    }
 }
 
 class Base {
@@ -408,6 +556,27 @@ public:
 
 bool Derived::i_was_deleted = false;
 
+struct ConversionLeft {
+    virtual ~ConversionLeft() = default;
+
+    int left = 1;
+};
+
+struct ConversionRight {
+    virtual ~ConversionRight() = default;
+    virtual int Value() const {
+        return right;
+    }
+
+    int right = 2;
+};
+
+struct ConversionBoth : ConversionLeft, ConversionRight {
+    int Value() const override {
+        return 3;
+    }
+};
+
 TEST_CASE("Type conversions") {
     SECTION("Destruction") {
         Derived::i_was_deleted = false;
@@ -415,6 +584,18 @@ TEST_CASE("Type conversions") {
         REQUIRE(Derived::i_was_deleted);
     }
 
+    SECTION("Base from MakeShared of derived") {
+        auto both = MakeShared<ConversionBoth>();
+        SharedPtr<ConversionRight> right = both;
+        SharedPtr<ConversionLeft> left = std::move(both);
+
+        REQUIRE(right.Get() == static_cast<ConversionRight*>(static_cast<ConversionBoth*>(left.Get())));
+        REQUIRE(right->Value() == 3);
+        REQUIRE((*right).right == 2);
+        REQUIRE(left->left == 1);
+        REQUIRE(right.UseCount() == 2);
+    }
+
     SECTION("Constness") {
         SharedPtr<int> s1(new int(42));
         SharedPtr<const int> s2 = s1;
@@ -431,6 +612,59 @@ TEST_CASE("Type conversions") {
     }
 }
 
+TEST_CASE("Pointer casts") {
+    SECTION("StaticPointerCast") {
+        SharedPtr<ConversionRight> right = MakeShared<ConversionBoth>();
+        auto both = StaticPointerCast<ConversionBoth>(right);
+        REQUIRE(static_cast<ConversionRight*>(both.Get()) == right.Get());
+        REQUIRE(both.UseCount() == 2);
+
+        auto moved = StaticPointerCast<ConversionBoth>(std::move(right));
+        REQUIRE(moved.Get() == both.Get());
+        REQUIRE(right.GetBlock() == nullptr);
+        REQUIRE(both.UseCount() == 2);
+    }
+
+    SECTION("DynamicPointerCast") {
+        SharedPtr<ConversionLeft> left = MakeShared<ConversionBoth>();
+        auto right = DynamicPointerCast<ConversionRight>(left);
+        REQUIRE(right->Value() == 3);
+        REQUIRE(left.UseCount() == 2);
+
+        SharedPtr<ConversionLeft> plain(new ConversionLeft);
+        REQUIRE(DynamicPointerCast<ConversionRight>(plain).Get() == nullptr);
+        // A failed cast leaves its argument alone
+        auto failed = DynamicPointerCast<ConversionRight>(std::move(plain));
+        REQUIRE(failed.GetBlock() == nullptr);
+        REQUIRE(plain.UseCount() == 1);
+
+        auto moved = DynamicPointerCast<ConversionBoth>(std::move(left));
+        REQUIRE(left.GetBlock() == nullptr);
+        REQUIRE(moved->left == 1);
+        REQUIRE(moved.UseCount() == 2);
+    }
+
+    SECTION("ConstPointerCast and ReinterpretPointerCast") {
+        SharedPtr<const int> constant = MakeShared<int>(5);
+        SharedPtr<int> mutable_int = ConstPointerCast<int>(constant);
+        *mutable_int = 6;
+        REQUIRE(*constant == 6);
+
+        auto bytes = ReinterpretPointerCast<unsigned char>(std::move(mutable_int));
+        REQUIRE(static_cast<const void*>(bytes.Get()) == constant.Get());
+        REQUIRE(constant.UseCount() == 2);
+        auto back = ConstPointerCast<int>(std::move(constant));
+        REQUIRE(*back == 6);
+        REQUIRE(back.UseCount() == 2);
+    }
+
+    SECTION("Empty pointers") {
+        SharedPtr<Base> empty;
+        REQUIRE(StaticPointerCast<Derived>(empty).Get() == nullptr);
+        REQUIRE(DynamicPointerCast<Derived>(std::move(empty)).GetBlock() == nullptr);
+    }
+}
+
 struct A {
     ~A() = default;
 };
@@ -467,3 +701,423 @@ TEST_CASE("Destructor for correct type") {
         REQUIRE(B::destructor_called);
     }
 }
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct Ordered {
+    static inline std::vector<int> destroyed;
+    static inline int throw_at = -1;
+    static inline int constructed = 0;
+
+    Ordered() : Ordered(0) {
+    }
+    explicit Ordered(int value) : value(value), index(constructed++) {
+        if (index == throw_at) {
+            throw 42;
+        }
+    }
+    ~Ordered() {
+        destroyed.push_back(index);
+    }
+
+    int value;
+    int index;
+};
+
+template <typename P>
+concept Dereferenceable = requires(P p) { *p; };
+
+template <typename P>
+concept HasArrow = requires(P p) { p.operator->(); };
+
+template <typename P>
+concept Indexable = requires(P p) { p[0]; };
+
+TEST_CASE("Arrays") {
+    Ordered::destroyed.clear();
+    Ordered::constructed = 0;
+    Ordered::throw_at = -1;
+
+    SECTION("MakeShared<T[]> makes one allocation") {
+        SharedPtr<int[]> sp;
+        EXPECT_ONE_ALLOCATION(sp = MakeShared<int[]>(100));
+        REQUIRE(sp[0] == 0);
+        REQUIRE(sp[99] == 0);
+        sp[5] = 42;
+        REQUIRE(sp.Get()[5] == 42);
+    }
+
+    SECTION("Initial value") {
+        auto sp = MakeShared<Ordered[]>(3, 7);
+        for (int i = 0; i < 3; ++i) {
+            REQUIRE(sp[i].value == 7);
+            REQUIRE(sp[i].index == i);
+        }
+    }
+
+    SECTION("Destroyed in reverse order") {
+        MakeShared<Ordered[]>(4);
+        REQUIRE(Ordered::destroyed == std::vector<int>{3, 2, 1, 0});
+
+        Ordered::destroyed.clear();
+        Ordered::constructed = 0;
+        MakeShared<Ordered[3]>();
+        REQUIRE(Ordered::destroyed == std::vector<int>{2, 1, 0});
+    }
+
+    SECTION("Faulty element constructor") {
+        Ordered::throw_at = 2;
+        REQUIRE_THROWS(MakeShared<Ordered[]>(5));
+        REQUIRE(Ordered::destroyed == std::vector<int>{1, 0});
+    }
+
+    SECTION("Bounded arrays") {
+        SharedPtr<double[4]> sp = MakeShared<double[4]>(1.5);
+        REQUIRE(sp[3] == 1.5);
+        SharedPtr<double[]> unbounded = sp;
+        REQUIRE(unbounded.UseCount() == 2);
+        REQUIRE(unbounded[0] == 1.5);
+    }
+
+    SECTION("Over-aligned elements") {
+        struct alignas(64) Wide {
+            int x = 3;
+        };
+        auto sp = MakeShared<Wide[]>(5);
+        REQUIRE(reinterpret_cast<uintptr_t>(sp.Get()) % 64 == 0);
+        REQUIRE(sp[4].x == 3);
+    }
+
+    SECTION("Empty array") {
+        auto sp = MakeShared<Ordered[]>(0);
+        REQUIRE(sp.UseCount() == 1);
+    }
+
+    SECTION("From new[]") {
+        {
+            SharedPtr<Ordered[]> sp(new Ordered[3]);
+            SharedPtr<Ordered[]> other;
+            other.Reset(new Ordered[2]);
+            REQUIRE(sp[2].index == 2);
+        }
+        REQUIRE(Ordered::destroyed.size() == 5);
+    }
+
+    SECTION("No operator* or operator-> on arrays") {
+        STATIC_REQUIRE(!Dereferenceable<SharedPtr<int[]>>);
+        STATIC_REQUIRE(!HasArrow<SharedPtr<int[]>>);
+        STATIC_REQUIRE(!Indexable<SharedPtr<int>>);
+        STATIC_REQUIRE(Dereferenceable<SharedPtr<int>>);
+        STATIC_REQUIRE(Indexable<SharedPtr<int[]>>);
+    }
+
+    SECTION("Arrays convert only to arrays of the same element type") {
+        // Indexing an array of Derived as one of Base would use the wrong stride
+        STATIC_REQUIRE(!std::is_constructible_v<SharedPtr<Base[]>, Derived*>);
+        STATIC_REQUIRE(!std::is_constructible_v<SharedPtr<Base[]>, SharedPtr<Derived[]>>);
+        STATIC_REQUIRE(!std::is_constructible_v<SharedPtr<Base[]>, SharedPtr<Derived[]>&&>);
+        STATIC_REQUIRE(!std::is_assignable_v<SharedPtr<Base[]>&, SharedPtr<Derived[]>>);
+        STATIC_REQUIRE(!std::is_constructible_v<SharedPtr<int[]>, SharedPtr<int>>);
+        STATIC_REQUIRE(!std::is_constructible_v<SharedPtr<int>, SharedPtr<int[]>>);
+        STATIC_REQUIRE(!std::is_assignable_v<SharedPtr<int>&, SharedPtr<int[]>>);
+        STATIC_REQUIRE(!std::is_constructible_v<SharedPtr<int>, int (*)[3]>);
+        STATIC_REQUIRE(!std::is_constructible_v<SharedPtr<Base>, SharedPtr<Derived[]>>);
+        STATIC_REQUIRE(!std::is_constructible_v<SharedPtr<Derived>, Base*>);
+
+        STATIC_REQUIRE(std::is_constructible_v<SharedPtr<const int[]>, SharedPtr<int[]>>);
+        STATIC_REQUIRE(std::is_constructible_v<SharedPtr<int[]>, SharedPtr<int[4]>>);
+        STATIC_REQUIRE(std::is_constructible_v<SharedPtr<Base>, Derived*>);
+        STATIC_REQUIRE(std::is_constructible_v<SharedPtr<Base>, SharedPtr<Derived>>);
+    }
+}
+
+TEST_CASE("MakeSharedForOverwrite") {
+    Ordered::destroyed.clear();
+    Ordered::constructed = 0;
+    Ordered::throw_at = -1;
+
+    SECTION("One allocation") {
+        using Buffer = std::array<char, 4096>;
+        SharedPtr<Buffer> buffer;
+        EXPECT_ONE_ALLOCATION(buffer = MakeSharedForOverwrite<Buffer>());
+        (*buffer)[4095] = 'x';
+        REQUIRE((*buffer)[4095] == 'x');
+
+        SharedPtr<char[]> chars;
+        EXPECT_ONE_ALLOCATION(chars = MakeSharedForOverwrite<char[]>(4096));
+        chars[0] = 'y';
+        REQUIRE(chars[0] == 'y');
+    }
+
+    SECTION("Default constructors still run") {
+        REQUIRE(MakeSharedForOverwrite<Ordered>()->value == 0);
+        REQUIRE(MakeSharedForOverwrite<Ordered[]>(3)[2].index == 3);
+        REQUIRE(MakeSharedForOverwrite<Ordered[2]>()[1].value == 0);
+        REQUIRE(Ordered::destroyed == std::vector<int>{0, 3, 2, 1, 5, 4});
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+struct PoolDeleter {
+    void operator()(int* ptr) const {
+        ++released;
+        delete ptr;
+    }
+
+    static inline int released = 0;
+};
+
+struct StatefulIntDeleter {
+    void operator()(int* ptr) {
+        ++*calls;
+        delete ptr;
+    }
+
+    int* calls;
+};
+
+TEST_CASE("Custom deleters") {
+    PoolDeleter::released = 0;
+
+    SECTION("Stateless deleter takes no space") {
+        using Block = AllocatedByUserWithDeleter<int, PoolDeleter, DefaultBlockAllocator<int>>;
+        STATIC_REQUIRE(sizeof(Block) == sizeof(AllocatedByUser<int>));
+        using StatefulBlock =
+            AllocatedByUserWithDeleter<int, StatefulIntDeleter, DefaultBlockAllocator<int>>;
+        STATIC_REQUIRE(sizeof(StatefulBlock) == sizeof(AllocatedByUser<int>) + sizeof(int*));
+    }
+
+    SECTION("One allocation for the block") {
+        int* raw = new int(1);
+        {
+            SharedPtr<int> sp;
+            EXPECT_ONE_ALLOCATION(sp = SharedPtr<int>(raw, PoolDeleter()));
+            SharedPtr<int> copy = sp;
+            REQUIRE(PoolDeleter::released == 0);
+        }
+        REQUIRE(PoolDeleter::released == 1);
+    }
+
+    SECTION("Stateful deleter and Reset") {
+        int calls = 0;
+        SharedPtr<int> sp(new int(1), StatefulIntDeleter{&calls});
+        sp.Reset(new int(2), StatefulIntDeleter{&calls});
+        REQUIRE(calls == 1);
+        REQUIRE(*sp == 2);
+        sp.Reset();
+        REQUIRE(calls == 2);
+    }
+
+    SECTION("Non-heap resources") {
+        int slots[4] = {};
+        int freed = -1;
+        {
+            SharedPtr<int> slot(&slots[2], [&](int* ptr) { freed = static_cast<int>(ptr - slots); });
+            *slot = 7;
+        }
+        REQUIRE(freed == 2);
+        REQUIRE(slots[2] == 7);
+    }
+
+    SECTION("Arrays") {
+        SharedPtr<int[]> sp(new int[3]{1, 2, 3}, [](int* ptr) { delete[] ptr; });
+        REQUIRE(sp[2] == 3);
+    }
+
+    SECTION("GetDeleter") {
+        int calls = 0;
+        SharedPtr<int> sp(new int(1), StatefulIntDeleter{&calls});
+        StatefulIntDeleter* deleter = sp.GetDeleter<StatefulIntDeleter>();
+        REQUIRE(deleter != nullptr);
+        REQUIRE(deleter->calls == &calls);
+        REQUIRE(sp.GetDeleter<PoolDeleter>() == nullptr);
+
+        SharedPtr<int> copy = sp;
+        REQUIRE(copy.GetDeleter<StatefulIntDeleter>() == deleter);
+
+        REQUIRE(SharedPtr<int>(new int(1)).GetDeleter<PoolDeleter>() == nullptr);
+        REQUIRE(MakeShared<int>(1).GetDeleter<PoolDeleter>() == nullptr);
+        REQUIRE(SharedPtr<int>().GetDeleter<PoolDeleter>() == nullptr);
+    }
+
+    SECTION("Deleter runs if the block cannot be allocated") {
+        int calls = 0;
+        REQUIRE_THROWS_AS(
+            SharedPtr<int>(new int(1), StatefulIntDeleter{&calls}, ThrowingAllocator<int>()),
+            std::bad_alloc);
+        REQUIRE(calls == 1);
+    }
+}
+
+TEST_CASE("ShareN and ReleaseN") {
+    SECTION("A batch of owners") {
+        auto sp = MakeShared<int>(7);
+        std::vector<SharedPtr<int>> subscribers = sp.ShareN(5);
+        REQUIRE(subscribers.size() == 5);
+        REQUIRE(sp.UseCount() == 6);
+        for (const auto& subscriber : subscribers) {
+            REQUIRE(subscriber.Get() == sp.Get());
+        }
+
+        ReleaseN(subscribers.begin(), subscribers.end());
+        REQUIRE(sp.UseCount() == 1);
+        for (const auto& subscriber : subscribers) {
+            REQUIRE(subscriber.Get() == nullptr);
+            REQUIRE(subscriber.GetBlock() == nullptr);
+        }
+    }
+
+    SECTION("Into an output iterator") {
+        auto sp = MakeShared<int>(7);
+        std::array<SharedPtr<int>, 4> slots;
+        auto end = sp.ShareN(3, slots.begin());
+        REQUIRE(end == slots.begin() + 3);
+        REQUIRE(sp.UseCount() == 4);
+        REQUIRE(slots[3].Get() == nullptr);
+        REQUIRE(sp.ShareN(0).empty());
+        REQUIRE(sp.UseCount() == 4);
+    }
+
+    SECTION("Batches beyond the 32-bit count are rejected") {
+        auto sp = MakeShared<int>(7);
+        constexpr size_t kTooMany = size_t{1} << 32;
+        std::array<SharedPtr<int>, 1> slots;
+        REQUIRE_THROWS_AS(sp.ShareN(kTooMany, slots.begin()), std::length_error);
+        REQUIRE_THROWS_AS(sp.ShareN(kTooMany), std::length_error);
+        REQUIRE(sp.UseCount() == 1);
+        REQUIRE(slots[0].Get() == nullptr);
+    }
+
+    SECTION("Empty pointers give empty ones") {
+        SharedPtr<int> empty;
+        auto batch = empty.ShareN(3);
+        REQUIRE(batch.size() == 3);
+        REQUIRE(batch[2].Get() == nullptr);
+        ReleaseN(batch.begin(), batch.end());
+    }
+
+    SECTION("Runs of different blocks") {
+        auto a = MakeShared<int>(1);
+        SharedPtr<int> b(new int(2));
+        std::vector<SharedPtr<int>> mixed = {a, a, b, nullptr, a, b};
+        REQUIRE(a.UseCount() == 4);
+        ReleaseN(mixed.begin(), mixed.begin() + 3);
+        REQUIRE(a.UseCount() == 2);
+        REQUIRE(b.UseCount() == 2);
+        ReleaseN(mixed.begin(), mixed.end());
+        REQUIRE(a.UseCount() == 1);
+        REQUIRE(b.UseCount() == 1);
+    }
+
+    SECTION("The last release destroys") {
+        auto batch = MakeShared<std::vector<int>>(100, 1).ShareN(3);
+        ReleaseN(batch.begin(), batch.end());
+        // The temporary is long gone, ASan checks that nothing leaked
+        REQUIRE(batch[0].Get() == nullptr);
+    }
+}
+
+TEST_CASE("ReleaseAll") {
+    SECTION("Duplicates anywhere in the range") {
+        auto a = MakeShared<int>(1);
+        SharedPtr<int> b(new int(2));
+        std::vector<SharedPtr<int>> ids = {a, b, a, nullptr, b, a, a};
+        REQUIRE(a.UseCount() == 5);
+        ReleaseAll(ids.begin(), ids.end());
+        REQUIRE(a.UseCount() == 1);
+        REQUIRE(b.UseCount() == 1);
+        for (const auto& id : ids) {
+            REQUIRE(id.Get() == nullptr);
+            REQUIRE(id.GetBlock() == nullptr);
+        }
+        ReleaseAll(ids.begin(), ids.end());
+        ReleaseAll(ids.begin(), ids.begin());
+    }
+
+    SECTION("Objects whose last owners were in the range are destroyed") {
+        std::vector<SharedPtr<std::vector<int>>> values;
+        for (int i = 0; i < 10; ++i) {
+            values.push_back(MakeShared<std::vector<int>>(10, i));
+            values.push_back(values.back());
+        }
+        auto survivor = values[4];
+        ReleaseAll(values.begin(), values.end());
+        REQUIRE(survivor.UseCount() == 1);
+        REQUIRE((*survivor)[0] == 2);
+    }
+
+    SECTION("Parallel destruction") {
+        std::vector<SharedPtr<std::vector<int>>> values;
+        for (size_t i = 0; i < 4 * kMinParallelRelease; ++i) {
+            values.push_back(MakeShared<std::vector<int>>(4, 1));
+            if (i % 3 == 0) {
+                values.push_back(values.back());
+            }
+        }
+        auto survivor = values[1];
+        ReleaseAll(values.begin(), values.end(), 4);
+        REQUIRE(survivor.UseCount() == 1);
+        REQUIRE(values.back().Get() == nullptr);
+    }
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Node : EnableSharedFromThis<Node, LocalCounting> {
+    explicit Node(int value) : value(value) {
+    }
+
+    int value;
+};
+
+// Pointers of different policies point to different block types
+template <class From, class To>
+constexpr bool kConverts = std::is_constructible_v<SharedPtr<int, To>, SharedPtr<int, From>> ||
+                           std::is_constructible_v<SharedPtr<int, To>, const SharedPtr<int, From>&>;
+
+}  // namespace
+
+static_assert(!kConverts<LocalCounting, AtomicCounting>);
+static_assert(!kConverts<AtomicCounting, LocalCounting>);
+static_assert(!kConverts<LocalCounting, BiasedCounting>);
+static_assert(!kConverts<BiasedCounting, AtomicCounting>);
+static_assert(sizeof(BasicBlock<LocalCounting>) == sizeof(void*) + 2 * sizeof(uint32_t));
+
+TEMPLATE_TEST_CASE("Every counting policy", "", LocalCounting, AtomicCounting, BiasedCounting) {
+    SharedPtr<std::vector<int>, TestType> sp(new std::vector<int>(3, 7));
+    auto copy = sp;
+    SharedPtr<std::vector<int>, TestType> moved(std::move(copy));
+    REQUIRE(sp.UseCount() == 2);
+    REQUIRE(copy.Get() == nullptr);
+
+    SharedPtr<int, TestType> element(moved, &(*moved)[1]);
+    REQUIRE(*element == 7);
+    REQUIRE(sp.UseCount() == 3);
+
+    std::vector<SharedPtr<std::vector<int>, TestType>> batch = sp.ShareN(4);
+    REQUIRE(sp.UseCount() == 7);
+    ReleaseAll(batch.begin(), batch.end(), 2);
+    moved.Reset();
+    element.Reset();
+    REQUIRE(sp.UseCount() == 1);
+}
+
+TEST_CASE("LocalSharedPtr") {
+    auto node = MakeLocalShared<Node>(5);
+    REQUIRE(node->value == 5);
+    REQUIRE(node.UseCount() == 1);
+
+    LocalSharedPtr<Node> self = node->SharedFromThis();
+    REQUIRE(self.Get() == node.Get());
+    REQUIRE(node.UseCount() == 2);
+
+    LocalSharedPtr<const Node> constant = self;
+    self.Reset();
+    REQUIRE(constant.UseCount() == 2);
+
+    LocalSharedPtr<int[]> array(new int[4]{1, 2, 3, 4});
+    REQUIRE(array[3] == 4);
+}
@@ -0,0 +1,152 @@
+#include "shared.h"
+#include "weak.h"
+
+#include <catch.hpp>
+
+#include "allocations_checker.h"
+
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+// Lands in a size class no other test touches
+struct Payload {
+    char data[150];
+};
+
+struct alignas(64) Aligned {
+    int x = 0;
+};
+
+// Runs `f` on a fresh thread and returns how many allocations it made there
+template <typename F>
+size_t AllocationsOnNewThread(F f) {
+    size_t count = 0;
+    std::thread([&] {
+        alloc_checker::ResetCounters();
+        f();
+        count = alloc_checker::AllocCount();
+    }).join();
+    return count;
+}
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Steady state is allocation-free") {
+    SECTION("MakeShared") {
+        MakeShared<int>(0);
+        EXPECT_ZERO_ALLOCATIONS(for (int i = 0; i < 1000; ++i) {
+            auto sp = MakeShared<int>(i);
+            WeakPtr<int> wp = sp;
+        });
+    }
+
+    SECTION("SharedPtr(T*)") {
+        std::vector<int*> raw;
+        for (int i = 0; i < 1000; ++i) {
+            raw.push_back(new int(i));
+        }
+        SharedPtr<int>(new int(0));
+        // Every block but the object itself comes from the cache
+        EXPECT_ZERO_ALLOCATIONS(for (int* ptr : raw) { SharedPtr<int> sp(ptr); });
+    }
+
+    SECTION("Many live blocks") {
+        std::vector<SharedPtr<int>> live;
+        live.reserve(500);
+        for (int i = 0; i < 500; ++i) {
+            live.push_back(MakeShared<int>(i));
+        }
+        live.clear();
+        EXPECT_ZERO_ALLOCATIONS(for (int i = 0; i < 500; ++i) {
+            live.push_back(MakeShared<int>(i));
+        });
+    }
+}
+
+TEST_CASE("Refills") {
+    SECTION("Cold thread takes one slab per batch") {
+        size_t count = AllocationsOnNewThread([] {
+            std::vector<SharedPtr<Payload>> live;
+            live.reserve(2 * SlabCache::kBatch);
+            alloc_checker::ResetCounters();
+            for (size_t i = 0; i < 2 * SlabCache::kBatch; ++i) {
+                live.push_back(MakeShared<Payload>());
+            }
+        });
+        REQUIRE(count == 2);
+    }
+
+    SECTION("Exiting thread hands its blocks over") {
+        // Both previous threads have returned their Payload blocks to the central list
+        size_t count = AllocationsOnNewThread([] {
+            for (size_t i = 0; i < 4 * SlabCache::kBatch; ++i) {
+                MakeShared<Payload>();
+            }
+        });
+        REQUIRE(count == 0);
+    }
+}
+
+TEST_CASE("Blocks return to the free list with the last weak reference") {
+    size_t block_size = sizeof(AllocatedByOurselves<Payload>);
+    auto sp = MakeShared<Payload>();
+    size_t cached = SlabCache::CachedBlocks(block_size);
+
+    WeakPtr<Payload> wp = sp;
+    sp.Reset();
+    REQUIRE(SlabCache::CachedBlocks(block_size) == cached);
+    wp.Reset();
+    REQUIRE(SlabCache::CachedBlocks(block_size) == cached + 1);
+}
+
+TEST_CASE("Blocks released on another thread") {
+    std::vector<SharedPtr<int>> made;
+    for (int i = 0; i < 300; ++i) {
+        made.push_back(MakeShared<int>(i));
+    }
+    size_t count = AllocationsOnNewThread([&] {
+        made.clear();
+        // The blocks that came from the main thread are now in this thread's cache
+        for (int i = 0; i < 200; ++i) {
+            MakeShared<int>(i);
+        }
+    });
+    REQUIRE(count == 0);
+}
+
+TEST_CASE("Sizes outside the classes") {
+    auto aligned = MakeShared<Aligned>();
+    REQUIRE(reinterpret_cast<uintptr_t>(aligned.Get()) % 64 == 0);
+
+    struct Big {
+        char data[1000];
+    };
+    auto big = MakeShared<Big>();
+    big->data[999] = 1;
+    REQUIRE(big->data[999] == 1);
+}
+
+TEST_CASE("Concurrent churn") {
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([] {
+            std::vector<SharedPtr<int>> live;
+            for (int i = 0; i < 20000; ++i) {
+                live.push_back(MakeShared<int>(i));
+                if (live.size() > 500) {
+                    live.clear();
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
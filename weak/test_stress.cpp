@@ -0,0 +1,149 @@
+#include "shared.h"
+#include "weak.h"
+
+#include <catch.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Tracked {
+    static inline std::atomic<int> alive = 0;
+    static inline std::atomic<int> destroyed = 0;
+
+    Tracked() {
+        ++alive;
+    }
+    ~Tracked() {
+        --alive;
+        ++destroyed;
+    }
+
+    int payload = 42;
+};
+
+template <typename F>
+void RunInThreads(size_t num_threads, F f) {
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_threads; ++i) {
+        threads.emplace_back(f, i);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+size_t MaxThreads() {
+    return std::clamp<size_t>(std::thread::hardware_concurrency(), 2, 16);
+}
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("Concurrent copies of one SharedPtr") {
+    constexpr int kIterations = 100'000;
+    Tracked::destroyed = 0;
+    {
+        SharedPtr<Tracked> from_new(new Tracked);
+        auto from_make = MakeShared<Tracked>();
+        std::atomic<int> bad_reads = 0;
+        RunInThreads(MaxThreads(), [&](size_t) {
+            for (int i = 0; i < kIterations; ++i) {
+                SharedPtr<Tracked> a = from_new;
+                SharedPtr<Tracked> b = from_make;
+                SharedPtr<Tracked> c;
+                c = a;
+                if (c->payload != 42 || b->payload != 42) {
+                    ++bad_reads;
+                }
+            }
+        });
+        REQUIRE(bad_reads == 0);
+        REQUIRE(from_new.UseCount() == 1);
+        REQUIRE(from_make.UseCount() == 1);
+        REQUIRE(Tracked::alive == 2);
+    }
+    REQUIRE(Tracked::alive == 0);
+    REQUIRE(Tracked::destroyed == 2);
+}
+
+TEST_CASE("Last SharedPtr and last WeakPtr released concurrently") {
+    constexpr int kRounds = 20'000;
+    Tracked::destroyed = 0;
+    for (int i = 0; i < kRounds; ++i) {
+        auto shared = MakeShared<Tracked>();
+        WeakPtr<Tracked> weak(shared);
+        SharedPtr<Tracked> shared_copy(shared);
+        WeakPtr<Tracked> weak_copy(weak);
+        shared.Reset();
+        weak.Reset();
+
+        std::thread strong_thread([&] { shared_copy.Reset(); });
+        std::thread weak_thread([&] { weak_copy.Reset(); });
+        strong_thread.join();
+        weak_thread.join();
+    }
+    REQUIRE(Tracked::alive == 0);
+    REQUIRE(Tracked::destroyed == kRounds);
+}
+
+TEST_CASE("Lock races the release of the last owner") {
+    constexpr int kRounds = 5'000;
+    Tracked::destroyed = 0;
+    std::atomic<int> bad_reads = 0;
+    for (int i = 0; i < kRounds; ++i) {
+        auto shared = MakeShared<Tracked>();
+        WeakPtr<Tracked> weak(shared);
+        std::atomic<bool> go = false;
+        RunInThreads(2, [&](size_t thread) {
+            while (!go.load()) {
+                go = true;
+            }
+            if (thread == 0) {
+                shared.Reset();
+                return;
+            }
+            // Once a Lock fails every later one must fail as well
+            bool expired = false;
+            for (int j = 0; j < 100; ++j) {
+                SharedPtr<Tracked> locked = j % 2 == 0 ? weak.Lock() : weak.TryLock();
+                if (locked.Get() == nullptr) {
+                    expired = true;
+                } else if (expired || locked->payload != 42) {
+                    ++bad_reads;
+                }
+            }
+        });
+        REQUIRE(weak.Expired());
+    }
+    REQUIRE(bad_reads == 0);
+    REQUIRE(Tracked::alive == 0);
+    REQUIRE(Tracked::destroyed == kRounds);
+}
+
+TEST_CASE("Copy/destroy throughput") {
+    constexpr int kIterations = 1'000'000;
+    auto shared = MakeShared<Tracked>();
+
+    std::cout << "threads\tcopy+destroy Mops/s (one shared block)\n";
+    for (size_t num_threads = 1; num_threads <= MaxThreads(); num_threads *= 2) {
+        auto start = std::chrono::steady_clock::now();
+        RunInThreads(num_threads, [&](size_t) {
+            for (int i = 0; i < kIterations; ++i) {
+                SharedPtr<Tracked> copy(shared);
+            }
+        });
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        double mops = static_cast<double>(num_threads) * kIterations / elapsed.count() / 1e6;
+        std::cout << num_threads << "\t" << mops << "\n";
+    }
+    REQUIRE(shared.UseCount() == 1);
+}
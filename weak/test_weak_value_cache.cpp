@@ -0,0 +1,157 @@
+#include "weak_value_cache.h"
+
+#include <catch.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+namespace {
+
+struct Texture {
+    static inline std::atomic<int> created = 0;
+    static inline std::atomic<int> alive = 0;
+
+    explicit Texture(int id) : id(id) {
+        ++created;
+        ++alive;
+    }
+    ~Texture() {
+        --alive;
+    }
+
+    int id;
+};
+
+// Seeded, so that a default-constructed copy would spread keys differently
+struct SeededHash {
+    explicit SeededHash(uint64_t seed = 0) : seed(seed) {
+    }
+
+    size_t operator()(int key) const {
+        ++*calls;
+        return std::hash<int>()(key) ^ seed;
+    }
+
+    uint64_t seed;
+    std::shared_ptr<std::atomic<int>> calls = std::make_shared<std::atomic<int>>(0);
+};
+
+}  // namespace
+
+////////////////////////////////////////////////////////////////////////////////////////////////////
+
+TEST_CASE("WeakValueCache basics") {
+    WeakValueCache<std::string, Texture> cache;
+    Texture::created = 0;
+
+    SECTION("GetOrCreate creates once while the value is alive") {
+        auto a = cache.GetOrCreate("grass", [] { return MakeShared<Texture>(1); });
+        auto b = cache.GetOrCreate("grass", [] { return MakeShared<Texture>(2); });
+        REQUIRE(a.Get() == b.Get());
+        REQUIRE(b->id == 1);
+        REQUIRE(Texture::created == 1);
+        REQUIRE(cache.Get("grass").Get() == a.Get());
+        REQUIRE(cache.Get("stone").Get() == nullptr);
+    }
+
+    SECTION("The cache does not keep values alive") {
+        {
+            auto a = cache.GetOrCreate("grass", [] { return MakeShared<Texture>(1); });
+            REQUIRE(Texture::alive == 1);
+        }
+        REQUIRE(Texture::alive == 0);
+        REQUIRE(cache.Get("grass").Get() == nullptr);
+
+        auto b = cache.GetOrCreate("grass", [] { return MakeShared<Texture>(2); });
+        REQUIRE(b->id == 2);
+        REQUIRE(cache.Size() == 1);
+    }
+
+    SECTION("Empty results are not stored") {
+        auto a = cache.GetOrCreate("grass", [] { return SharedPtr<Texture>(); });
+        REQUIRE(a.Get() == nullptr);
+        REQUIRE(cache.Size() == 0);
+    }
+
+    SECTION("Put and Erase") {
+        auto a = MakeShared<Texture>(1);
+        auto b = MakeShared<Texture>(2);
+        cache.Put("grass", a);
+        REQUIRE(cache.Get("grass").Get() == a.Get());
+        cache.Put("grass", b);
+        REQUIRE(cache.Get("grass").Get() == b.Get());
+        cache.Erase("grass");
+        REQUIRE(cache.Get("grass").Get() == nullptr);
+        REQUIRE(cache.Size() == 0);
+    }
+}
+
+TEST_CASE("WeakValueCache stripes") {
+    REQUIRE(WeakValueCache<int, Texture>(1).StripeCount() == 1);
+    REQUIRE(WeakValueCache<int, Texture>(0).StripeCount() == 1);
+    REQUIRE(WeakValueCache<int, Texture>(5).StripeCount() == 8);
+    REQUIRE(WeakValueCache<int, Texture>().StripeCount() == 64);
+}
+
+TEST_CASE("WeakValueCache uses the hasher it was given") {
+    SeededHash hash(0x5eed);
+    WeakValueCache<int, Texture, SeededHash> cache(8, hash);
+    auto texture = MakeShared<Texture>(7);
+    cache.Put(7, texture);
+    REQUIRE(cache.Get(7).Get() == texture.Get());
+    // Stripe lookups and the maps inside both hashed with the given instance
+    REQUIRE(*hash.calls >= 4);
+}
+
+TEST_CASE("WeakValueCache drops expired entries incrementally") {
+    constexpr int kKeys = 100'000;
+    WeakValueCache<int, Texture> cache(4);
+    std::vector<SharedPtr<Texture>> kept;
+    for (int i = 0; i < kKeys; ++i) {
+        auto texture = cache.GetOrCreate(i, [i] { return MakeShared<Texture>(i); });
+        // Every tenth value stays alive
+        if (i % 10 == 0) {
+            kept.push_back(texture);
+        }
+    }
+    // Without sweeping, all kKeys entries would still be there
+    REQUIRE(cache.Size() < 2 * kept.size());
+    for (const auto& texture : kept) {
+        REQUIRE(cache.Get(texture->id).Get() == texture.Get());
+    }
+}
+
+TEST_CASE("WeakValueCache from many threads") {
+    constexpr int kKeys = 64;
+    constexpr int kIterations = 20'000;
+    WeakValueCache<int, Texture> cache(8);
+    std::atomic<int> wrong = 0;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            // Keeps a few values alive, so that lookups see both live and expired entries
+            std::vector<SharedPtr<Texture>> held(8);
+            for (int i = 0; i < kIterations; ++i) {
+                int key = (i * 7 + t) % kKeys;
+                auto texture = cache.GetOrCreate(key, [key] { return MakeShared<Texture>(key); });
+                if (texture->id != key) {
+                    ++wrong;
+                }
+                held[i % held.size()] = std::move(texture);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    REQUIRE(wrong == 0);
+    REQUIRE(Texture::alive == 0);
+    REQUIRE(cache.Size() <= kKeys);
+}
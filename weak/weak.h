@@ -3,13 +3,15 @@
 #include "sw_fwd.h"  // Forward declaration
 #include "shared.h"
 // https://en.cppreference.com/w/cpp/memory/weak_ptr
-template <typename T>
+template <typename T, class Counting>
 class WeakPtr {
 public:
+    using BlockType = BasicBlock<Counting>;
+
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Constructors
 
-    WeakPtr() {
+    WeakPtr() noexcept {
         object_ = nullptr;
         block_ = nullptr;
     };
@@ -17,20 +19,21 @@ public:
     WeakPtr(const WeakPtr& other) {
         object_ = other.Get();
         block_ = other.GetBlock();
-        if (Get() != nullptr) {
+        if (block_ != nullptr) {
             block_->IncCounterWeak();
         }
     };
-    WeakPtr(WeakPtr&& other) {
-        object_ = other.Get();
-        block_ = other.GetBlock();
-        block_->IncCounterWeak();
-        other.Reset();
+    // Takes the reference over from `other` without touching the counters
+    WeakPtr(WeakPtr&& other) noexcept {
+        object_ = other.object_;
+        block_ = other.block_;
+        other.object_ = nullptr;
+        other.block_ = nullptr;
     };
 
     // Demote `SharedPtr`
     // #2 from https://en.cppreference.com/w/cpp/memory/weak_ptr/weak_ptr
-    WeakPtr(const SharedPtr<T>& other) {
+    WeakPtr(const SharedPtr<T, Counting>& other) {
         object_ = other.Get();
         block_ = other.GetBlock();
         if (GetBlock() != nullptr) {
@@ -42,44 +45,30 @@ public:
     // `operator=`-s
 
     WeakPtr& operator=(const WeakPtr& other) {
-        if (Get() == nullptr) {
-            object_ = other.Get();
-            block_ = other.GetBlock();
-        } else {
-            object_ = other.Get();
-            block_->DecCounterWeak();
-            block_ = other.block_;
+        if (other.block_ != nullptr) {
+            other.block_->IncCounterWeak();
         }
-        if (Get() != nullptr) {
-            block_->IncCounterWeak();
+        if (block_ != nullptr) {
+            block_->DecCounterWeak();
         }
+        object_ = other.object_;
+        block_ = other.block_;
         return *this;
     };
 
-    WeakPtr& operator=(const SharedPtr<T>& other) {
-        if (Get() == nullptr) {
-            object_ = other.Get();
-            block_ = other.GetBlock();
-        } else {
-            object_ = other.Get();
-            block_->DecCounterWeak();
-            block_ = other.GetBlock();
-        }
-        if (Get() != nullptr) {
-            block_->IncCounterWeak();
+    WeakPtr& operator=(const SharedPtr<T, Counting>& other) {
+        if (other.GetBlock() != nullptr) {
+            other.GetBlock()->IncCounterWeak();
         }
-        return *this;
-    };
-    WeakPtr& operator=(WeakPtr&& other) {
-        if (Get() != nullptr) {
+        if (block_ != nullptr) {
             block_->DecCounterWeak();
         }
         object_ = other.Get();
         block_ = other.GetBlock();
-        if (object_ != nullptr) {
-            block_->IncCounterWeak();
-        }
-        other.Reset();
+        return *this;
+    };
+    WeakPtr& operator=(WeakPtr&& other) noexcept {
+        WeakPtr(std::move(other)).Swap(*this);
         return *this;
     };
 
@@ -87,7 +76,7 @@ public:
     // Destructor
 
     ~WeakPtr() {
-        if (block_ != nullptr && block_->GetCountWeak() > 0) {
+        if (block_ != nullptr) {
             block_->DecCounterWeak();
         }
     };
@@ -95,7 +84,7 @@ public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Modifiers
 
-    void Reset() {
+    void Reset() noexcept {
         if (block_ != nullptr) {
             object_ = nullptr;
             block_->DecCounterWeak();
@@ -103,7 +92,7 @@ public:
         }
     };
 
-    void Swap(WeakPtr& other) {
+    void Swap(WeakPtr& other) noexcept {
         std::swap(object_, other.object_);
         std::swap(block_, other.block_);
     };
@@ -111,18 +100,11 @@ public:
     ////////////////////////////////////////////////////////////////////////////////////////////////
     // Observers
 
-    T* Get() const {
-        if (UseCount() == 0) {
-            return nullptr;
-        }
-        if (block_ != nullptr && object_ == nullptr) {
-            AllocatedByOurselves<T>* block = dynamic_cast<AllocatedByOurselves<T>*>(block_);
-            return block->GetObject();
-        } else {
-            return object_;
-        }
+    // Stored pointer; it dangles once the object expires, so go through Lock() to use it
+    std::remove_extent_t<T>* Get() const {
+        return object_;
     }
-    BlockBase* GetBlock() const {
+    BlockType* GetBlock() const {
         return block_;
     }
     size_t UseCount() const {
@@ -143,22 +125,94 @@ public:
             return true;
         }
     };
-    SharedPtr<T> Lock() const {
-        if (Get() == nullptr) {
-            SharedPtr<T> ptr;
-            return ptr;
-        } else {
-            /*if(block_->GetCountWeak()>0){
-                block_->DecCounterWeak();
-            }*/
-            SharedPtr<T> ptr(*this);
+    // A SharedPtr to the object, or an empty one if it has expired. One compare-and-swap loop
+    // that increments the strong count only while it is nonzero, so it is safe against a
+    // concurrent release of the last owner and never throws.
+    SharedPtr<T, Counting> Lock() const noexcept {
+        return TryLock();
+    };
 
-            return ptr;
+    // Same as Lock(); the name says that failure is expected and cheap
+    SharedPtr<T, Counting> TryLock() const noexcept {
+        if (block_ == nullptr || !block_->IncCounterIfNonZero()) {
+            return SharedPtr<T, Counting>();
         }
+        return SharedPtr<T, Counting>(typename SharedPtr<T, Counting>::AdoptBlock{}, object_,
+                                      block_);
     };
 
 private:
-    T* object_;
-    BlockBase* block_;
+    template <typename Y, class C>
+    friend class EnableSharedFromThis;
+
+    // Takes a new weak reference to `block`, which may be null
+    WeakPtr(std::remove_extent_t<T>* object, BlockType* block) noexcept {
+        object_ = block != nullptr ? object : nullptr;
+        block_ = block;
+        if (block_ != nullptr) {
+            block_->IncCounterWeak();
+        }
+    };
+
+    std::remove_extent_t<T>* object_;
+    BlockType* block_;
 };
 
+
+#ifdef SHARED_PTR_HAZARD_POINTERS
+// Read access to the object of a WeakPtr for the length of a scope, without touching its
+// counters: the guard publishes the block as a hazard, and a final release that sees it defers
+// the destruction until the guard is gone. `weak` has to outlive the guard, since the guard
+// does not hold the block. When all the thread's hazard slots are taken, the guard falls back
+// to a strong reference.
+//     HazardGuard guard(weak);
+//     if (guard) { Use(guard->field); }
+template <typename T>
+class HazardGuard {
+public:
+    explicit HazardGuard(const WeakPtr<T>& weak) noexcept {
+        BlockBase* block = weak.GetBlock();
+        if (block == nullptr) {
+            return;
+        }
+        slot_ = HazardPointers<BlockBase>::Acquire();
+        if (slot_ == nullptr) {
+            fallback_ = weak.TryLock();
+            object_ = fallback_.Get();
+            return;
+        }
+        HazardPointers<BlockBase>::Protect(slot_, block);
+        if (block->GetCount() > 0) {
+            object_ = weak.Get();
+        }
+    }
+
+    HazardGuard(const HazardGuard&) = delete;
+    HazardGuard& operator=(const HazardGuard&) = delete;
+
+    ~HazardGuard() {
+        if (slot_ != nullptr) {
+            HazardPointers<BlockBase>::Release(slot_);
+        }
+    }
+
+    // Null when the object had already expired
+    std::remove_extent_t<T>* Get() const {
+        return object_;
+    }
+    std::remove_extent_t<T>& operator*() const {
+        return *object_;
+    }
+    std::remove_extent_t<T>* operator->() const {
+        return object_;
+    }
+    explicit operator bool() const {
+        return object_ != nullptr;
+    }
+
+private:
+    HazardPointers<BlockBase>::Slot* slot_ = nullptr;
+    std::remove_extent_t<T>* object_ = nullptr;
+    SharedPtr<T> fallback_;
+};
+#endif
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "shared.h"
+#include "weak.h"
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Map from keys to values that the cache does not keep alive: it holds WeakPtr-s, and a value
+// lives as long as somebody outside holds a SharedPtr to it.
+//
+// Keys are spread over a power-of-two number of stripes, each an unordered_map behind its own
+// shared_mutex. A hit takes the stripe's lock shared and promotes the entry with
+// WeakPtr::TryLock, so concurrent readers only contend on the lock word and on the value's
+// strong count. A miss takes the lock exclusively, looks again and calls the factory under it,
+// so one key is created at most once at a time; the factory must not use the same cache.
+//
+// Expired entries are dropped incrementally rather than by full sweeps: every insertion into a
+// stripe scans the next kBucketsPerInsert buckets of its map, wrapping around, so a stripe is
+// swept once per (bucket count / kBucketsPerInsert) insertions. An expired entry met by a miss
+// is reused in place. Note that an entry keeps its control block alive, and with MakeShared
+// the block holds the value's storage too.
+template <typename K, typename V, typename Hash = std::hash<K>, typename KeyEqual = std::equal_to<K>>
+class WeakValueCache {
+public:
+    static constexpr size_t kBucketsPerInsert = 2;
+
+    // `stripes` is rounded up to a power of two; the stripes and their maps share `hash`
+    explicit WeakValueCache(size_t stripes = 64, const Hash& hash = Hash(),
+                            const KeyEqual& equal = KeyEqual())
+        : stripes_(std::bit_ceil(stripes == 0 ? 1 : stripes)),
+          shift_(64 - std::countr_zero(stripes_.size())),
+          hash_(hash) {
+        for (Stripe& stripe : stripes_) {
+            stripe.map = Map(0, hash, equal);
+        }
+    }
+
+    WeakValueCache(const WeakValueCache&) = delete;
+    WeakValueCache& operator=(const WeakValueCache&) = delete;
+
+    // The live value of `key`, or an empty pointer
+    SharedPtr<V> Get(const K& key) const {
+        const Stripe& stripe = StripeOf(key);
+        std::shared_lock lock(stripe.mutex);
+        auto it = stripe.map.find(key);
+        return it == stripe.map.end() ? SharedPtr<V>() : it->second.TryLock();
+    }
+
+    // The live value of `key`; if there is none, stores and returns `factory()`, which must
+    // return something convertible to SharedPtr<V>. An empty result is returned but not stored.
+    template <typename Factory>
+    SharedPtr<V> GetOrCreate(const K& key, Factory&& factory) {
+        Stripe& stripe = StripeOf(key);
+        {
+            std::shared_lock lock(stripe.mutex);
+            auto it = stripe.map.find(key);
+            if (it != stripe.map.end()) {
+                if (SharedPtr<V> value = it->second.TryLock()) {
+                    return value;
+                }
+            }
+        }
+        std::lock_guard lock(stripe.mutex);
+        auto it = stripe.map.find(key);
+        if (it != stripe.map.end()) {
+            if (SharedPtr<V> value = it->second.TryLock()) {
+                return value;
+            }
+        }
+        SharedPtr<V> value = std::forward<Factory>(factory)();
+        if (!value) {
+            return value;
+        }
+        if (it != stripe.map.end()) {
+            it->second = value;
+        } else {
+            stripe.map.emplace(key, value);
+            SweepStep(stripe);
+        }
+        return value;
+    }
+
+    // Stores `value` under `key`, replacing whatever was there
+    void Put(const K& key, const SharedPtr<V>& value) {
+        Stripe& stripe = StripeOf(key);
+        std::lock_guard lock(stripe.mutex);
+        auto [it, inserted] = stripe.map.insert_or_assign(key, value);
+        if (inserted) {
+            SweepStep(stripe);
+        }
+    }
+
+    void Erase(const K& key) {
+        Stripe& stripe = StripeOf(key);
+        std::lock_guard lock(stripe.mutex);
+        stripe.map.erase(key);
+    }
+
+    // Entries, expired ones that were not swept yet included
+    size_t Size() const {
+        size_t size = 0;
+        for (const Stripe& stripe : stripes_) {
+            std::shared_lock lock(stripe.mutex);
+            size += stripe.map.size();
+        }
+        return size;
+    }
+
+    size_t StripeCount() const {
+        return stripes_.size();
+    }
+
+private:
+    using Map = std::unordered_map<K, WeakPtr<V>, Hash, KeyEqual>;
+
+    // Own cache line, so that readers of neighbouring stripes do not share the lock word
+    struct alignas(64) Stripe {
+        mutable std::shared_mutex mutex;
+        Map map;
+        size_t next_bucket = 0;
+    };
+
+    Stripe& StripeOf(const K& key) {
+        return stripes_[Index(key)];
+    }
+    const Stripe& StripeOf(const K& key) const {
+        return stripes_[Index(key)];
+    }
+
+    // Fibonacci hashing: the maps inside the stripes use the low bits of the same hash, so the
+    // stripe is picked by the high bits of its product with 2^64 / phi
+    size_t Index(const K& key) const {
+        if (stripes_.size() == 1) {
+            return 0;
+        }
+        uint64_t hash = static_cast<uint64_t>(hash_(key));
+        return static_cast<size_t>((hash * 0x9E3779B97F4A7C15ull) >> shift_);
+    }
+
+    // Called under the exclusive lock, after an insertion
+    static void SweepStep(Stripe& stripe) {
+        auto& map = stripe.map;
+        for (size_t i = 0; i < kBucketsPerInsert; ++i) {
+            size_t bucket = stripe.next_bucket++ % map.bucket_count();
+            // Erasing invalidates the bucket's local iterators; buckets hold about one entry
+            const K* expired[4];
+            size_t count = 0;
+            for (auto it = map.begin(bucket); it != map.end(bucket) && count < 4; ++it) {
+                if (it->second.Expired()) {
+                    expired[count++] = &it->first;
+                }
+            }
+            while (count > 0) {
+                map.erase(map.find(*expired[--count]));
+            }
+        }
+    }
+
+    std::vector<Stripe> stripes_;
+    int shift_;
+    [[no_unique_address]] Hash hash_;
+};